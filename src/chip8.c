@@ -0,0 +1,600 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include "chip8.h"
+
+#define LOG_LEN 128
+
+//quirks of the custom profile, override them at build time with -D
+#ifndef CHIP8_CUSTOM_SHIFT_VY
+#define CHIP8_CUSTOM_SHIFT_VY 0
+#endif
+#ifndef CHIP8_CUSTOM_LOAD_STORE_INC_I
+#define CHIP8_CUSTOM_LOAD_STORE_INC_I 1
+#endif
+#ifndef CHIP8_CUSTOM_JUMP_VX
+#define CHIP8_CUSTOM_JUMP_VX 0
+#endif
+#ifndef CHIP8_CUSTOM_CLIP_SPRITES
+#define CHIP8_CUSTOM_CLIP_SPRITES 0
+#endif
+#ifndef CHIP8_CUSTOM_VF_RESET
+#define CHIP8_CUSTOM_VF_RESET 0
+#endif
+#ifndef CHIP8_CUSTOM_ADD_I_VF
+#define CHIP8_CUSTOM_ADD_I_VF 1
+#endif
+#ifndef CHIP8_CUSTOM_SCHIP
+#define CHIP8_CUSTOM_SCHIP 0
+#endif
+#ifndef CHIP8_CUSTOM_XOCHIP
+#define CHIP8_CUSTOM_XOCHIP 0
+#endif
+
+//the SUPER-CHIP 8x10 font sits right after the small one
+#define BIG_FONT_START 0x50
+
+//one framebuffer row, the leftmost pixel in the high bit
+typedef unsigned __int128 chip8_row;
+
+//every address a program computes wraps around the machine's memory
+#define ADDR(chip8, addr) ((addr) & ((chip8)->memory_size - 1))
+
+static const unsigned char font_set[] = {
+    0xF0, 0x90, 0x90, 0x90, 0xF0, //0
+    0x20, 0x60, 0x20, 0x20, 0x70, //1
+    0xF0, 0x10, 0xF0, 0x80, 0xF0, //2
+    0xF0, 0x10, 0xF0, 0x10, 0xF0, //3
+    0x90, 0x90, 0xF0, 0x10, 0x10, //4
+    0xF0, 0x80, 0xF0, 0x10, 0xF0, //5
+    0xF0, 0x80, 0xF0, 0x90, 0xF0, //6
+    0xF0, 0x10, 0x20, 0x40, 0x40, //7
+    0xF0, 0x90, 0xF0, 0x90, 0xF0, //8
+    0xF0, 0x90, 0xF0, 0x10, 0xF0, //9
+    0xF0, 0x90, 0xF0, 0x90, 0x90, //A
+    0xE0, 0x90, 0xE0, 0x90, 0xE0, //B
+    0xF0, 0x80, 0x80, 0x80, 0xF0, //C
+    0xE0, 0x90, 0x90, 0x90, 0xE0, //D
+    0xF0, 0x80, 0xF0, 0x80, 0xF0, //E
+    0xF0, 0x80, 0xF0, 0x80, 0x80  //F
+};
+
+static const unsigned char big_font_set[] = {
+    0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, //0
+    0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, //1
+    0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, //2
+    0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, //3
+    0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, //4
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, //5
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, //6
+    0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, //7
+    0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, //8
+    0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, //9
+    0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, //A
+    0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, //B
+    0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, //C
+    0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, //D
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, //E
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  //F
+};
+
+static void
+chip8_log(struct chip8 *chip8, const char *fmt, ...) {
+    char msg[LOG_LEN];
+    va_list ap;
+
+    if (chip8->callbacks.log == NULL) {
+        return;
+    }
+
+    va_start(ap, fmt);
+    vsnprintf(msg, sizeof(msg), fmt, ap);
+    va_end(ap);
+
+    chip8->callbacks.log(chip8->callbacks.ctx, msg);
+}
+
+//xorshift32, so every machine has its own reproducible random stream
+static uint8_t
+chip8_rand(struct chip8 *chip8) {
+    uint32_t x = chip8->rng;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    chip8->rng = x;
+
+    return x & 0xFF;
+}
+
+//the framebuffer helpers below work on whole rows, so scrolling is a shift per row
+//or a memmove of rows rather than a loop over pixels
+
+static inline chip8_row
+chip8_row_get(const struct chip8 *chip8, int plane, int y) {
+    const uint64_t *row = chip8->gfx[plane][y];
+
+    return (chip8_row)row[0] << 64 | row[1];
+}
+
+//in low resolution anything right of the first word is dropped
+static inline void
+chip8_row_put(struct chip8 *chip8, int plane, int y, chip8_row row) {
+    chip8->gfx[plane][y][0] = row >> 64;
+    chip8->gfx[plane][y][1] = chip8->gfx_width == CHIP8_GFX_MAX_WIDTH ? (uint64_t)row : 0;
+}
+
+//clears the selected planes
+static void
+chip8_gfx_clear(struct chip8 *chip8, uint8_t planes) {
+    int p;
+
+    for (p = 0; p < CHIP8_GFX_PLANES; p++) {
+        if (planes & (1 << p)) {
+            memset(chip8->gfx[p], 0, sizeof(chip8->gfx[p]));
+        }
+    }
+
+    chip8->gfx_dirty = ~0ULL;
+}
+
+//switches between the 64x32 and 128x64 displays, which clears every plane
+static void
+chip8_gfx_resize(struct chip8 *chip8, bool hires) {
+    chip8->gfx_width = hires ? CHIP8_GFX_MAX_WIDTH : CHIP8_GFX_WIDTH;
+    chip8->gfx_height = hires ? CHIP8_GFX_MAX_HEIGHT : CHIP8_GFX_HEIGHT;
+    chip8_gfx_clear(chip8, (1 << CHIP8_GFX_PLANES) - 1);
+}
+
+//scrolls the selected planes down by n rows, or up when n is negative
+static void
+chip8_gfx_scroll_vertical(struct chip8 *chip8, int n) {
+    size_t row = sizeof(chip8->gfx[0][0]);
+    int p, h = chip8->gfx_height, count = n < 0 ? -n : n;
+
+    if (count > h) {
+        count = h;
+    }
+
+    for (p = 0; p < CHIP8_GFX_PLANES; p++) {
+        if ((chip8->planes & (1 << p)) == 0) {
+            continue;
+        }
+
+        if (n > 0) {
+            memmove(chip8->gfx[p][count], chip8->gfx[p][0], (h - count) * row);
+            memset(chip8->gfx[p][0], 0, count * row);
+        }
+        else {
+            memmove(chip8->gfx[p][0], chip8->gfx[p][count], (h - count) * row);
+            memset(chip8->gfx[p][h - count], 0, count * row);
+        }
+    }
+
+    chip8->gfx_dirty = ~0ULL;
+}
+
+//scrolls the selected planes right by n pixels, or left when n is negative
+static void
+chip8_gfx_scroll_horizontal(struct chip8 *chip8, int n) {
+    int p, y;
+
+    for (p = 0; p < CHIP8_GFX_PLANES; p++) {
+        if ((chip8->planes & (1 << p)) == 0) {
+            continue;
+        }
+
+        for (y = 0; y < chip8->gfx_height; y++) {
+            if (n > 0) {
+                chip8_row_put(chip8, p, y, chip8_row_get(chip8, p, y) >> n);
+            }
+            else {
+                chip8_row_put(chip8, p, y, chip8_row_get(chip8, p, y) << -n);
+            }
+        }
+    }
+
+    chip8->gfx_dirty = ~0ULL;
+}
+
+struct chip8 *
+chip8_create() {
+    struct chip8 *chip8;
+
+    chip8 = calloc(1, sizeof(*chip8));
+    if (chip8 == NULL) {
+        return NULL;
+    }
+
+    chip8_seed(chip8, 1);
+    chip8_reset(chip8);
+
+    return chip8;
+}
+
+void
+chip8_destroy(struct chip8 *chip8) {
+    free(chip8);
+}
+
+void
+chip8_set_callbacks(struct chip8 *chip8, const struct chip8_callbacks *callbacks) {
+    if (callbacks == NULL) {
+        memset(&chip8->callbacks, 0, sizeof(chip8->callbacks));
+    }
+    else {
+        chip8->callbacks = *callbacks;
+    }
+}
+
+void
+chip8_seed(struct chip8 *chip8, uint32_t seed) {
+    //xorshift gets stuck at 0 forever
+    chip8->rng = seed == 0 ? 0x9E3779B9 : seed;
+}
+
+bool
+chip8_load(struct chip8 *chip8, const char *path) {
+    unsigned char rom[sizeof(chip8->rom)];
+    FILE *f;
+    size_t count;
+
+    chip8_log(chip8, "Loading %s", path);
+
+    f = fopen(path, "rb");
+    if (f == NULL) {
+        chip8_log(chip8, "%s", strerror(errno));
+        return false;
+    }
+
+    count = fread(rom, sizeof(unsigned char), sizeof(rom), f);
+    fclose(f);
+
+    return chip8_load_mem(chip8, rom, count);
+}
+
+bool
+chip8_load_mem(struct chip8 *chip8, const unsigned char *rom, size_t size) {
+    if (size < sizeof(chip8->opcode)) {
+        chip8_log(chip8, "Invalid ROM");
+        return false;
+    }
+
+    if (size > sizeof(chip8->rom)) {
+        size = sizeof(chip8->rom);
+    }
+
+    memcpy(chip8->rom, rom, size);
+    chip8->rom_size = size;
+
+    chip8_reset(chip8);
+
+    return true;
+}
+
+//puts the machine back to power-on state with the loaded ROM in memory
+//the random number generator is left alone so callers can decide whether to reseed
+void
+chip8_reset(struct chip8 *chip8) {
+    const struct chip8_quirks *quirks = chip8_profile_quirks(chip8->profile);
+    uint32_t memory_size = quirks->xochip ? CHIP8_MEMORY_MAX : CHIP8_MEMORY_SIZE;
+    size_t rom_size;
+
+    //every access is wrapped to memory_size, so only what the last run could reach needs clearing
+    memset(chip8->memory, 0, chip8->memory_size > memory_size ? chip8->memory_size : memory_size);
+    memset(chip8->V, 0, sizeof(chip8->V));
+    memset(chip8->stack, 0, sizeof(chip8->stack));
+    memset(chip8->key, 0, sizeof(chip8->key));
+    memset(chip8->audio_pattern, 0, sizeof(chip8->audio_pattern));
+
+    //program counter starts 512 bytes into memory
+    chip8->pc = CHIP8_PROGRAM_START;
+
+    chip8->opcode = 0;
+    chip8->I = 0;
+    chip8->sp = 0;
+    chip8->dt = 0;
+    chip8->st = 0;
+    chip8->cycles = 0;
+    chip8->sound_on_cycle = 0;
+    chip8->sound_off_cycle = 0;
+    chip8->pitch = 64;
+    chip8->memory_size = memory_size;
+
+    //every profile starts in low resolution drawing to the first plane
+    chip8->planes = 1;
+    chip8_gfx_resize(chip8, false);
+
+    //load the font sets into memory
+    memcpy(chip8->memory, font_set, sizeof(font_set));
+    if (quirks->schip) {
+        memcpy(chip8->memory + BIG_FONT_START, big_font_set, sizeof(big_font_set));
+    }
+
+    //read the ROM starting at 512 bytes into memory, as much of it as this profile's memory holds
+    rom_size = chip8->rom_size;
+    if (rom_size > chip8->memory_size - CHIP8_PROGRAM_START) {
+        rom_size = chip8->memory_size - CHIP8_PROGRAM_START;
+    }
+
+    memcpy(chip8->memory + CHIP8_PROGRAM_START, chip8->rom, rom_size);
+}
+
+//every profile's quirks in struct chip8_quirks order: shift_vy, load_store_inc_i, jump_vx,
+//clip_sprites, vf_reset, add_i_vf, schip, xochip
+//both the interpreters compiled below and profiles[] take their quirks from here
+#define CHIP8_QUIRKS_default 0, 1, 0, 0, 0, 1, 0, 0
+#define CHIP8_QUIRKS_cosmac  1, 1, 0, 1, 1, 1, 0, 0
+#define CHIP8_QUIRKS_schip   0, 0, 1, 1, 0, 1, 1, 0
+#define CHIP8_QUIRKS_xochip  0, 1, 0, 0, 0, 0, 1, 1
+#define CHIP8_QUIRKS_custom \
+    CHIP8_CUSTOM_SHIFT_VY, CHIP8_CUSTOM_LOAD_STORE_INC_I, CHIP8_CUSTOM_JUMP_VX, CHIP8_CUSTOM_CLIP_SPRITES, \
+    CHIP8_CUSTOM_VF_RESET, CHIP8_CUSTOM_ADD_I_VF, CHIP8_CUSTOM_SCHIP, CHIP8_CUSTOM_XOCHIP
+
+//every profile in enum chip8_profile order
+#define CHIP8_PROFILES(X) X(default) X(cosmac) X(schip) X(xochip) X(custom)
+
+#define PROFILE_CAT(a, b) PROFILE_CAT_(a, b)
+#define PROFILE_CAT_(a, b) a##b
+
+#define QUIRK_GET(get, quirks) get(quirks)
+#define QUIRK_0(a, b, c, d, e, f, g, h) a
+#define QUIRK_1(a, b, c, d, e, f, g, h) b
+#define QUIRK_2(a, b, c, d, e, f, g, h) c
+#define QUIRK_3(a, b, c, d, e, f, g, h) d
+#define QUIRK_4(a, b, c, d, e, f, g, h) e
+#define QUIRK_5(a, b, c, d, e, f, g, h) f
+#define QUIRK_6(a, b, c, d, e, f, g, h) g
+#define QUIRK_7(a, b, c, d, e, f, g, h) h
+
+//chip8profile.inc is included once per profile with PROFILE set to its name, these follow from it
+#define PROFILE_NAME(name) PROFILE_CAT(PROFILE_CAT(chip8_, PROFILE), _##name)
+#define PROFILE_QUIRKS PROFILE_CAT(CHIP8_QUIRKS_, PROFILE)
+#define QUIRK_SHIFT_VY         QUIRK_GET(QUIRK_0, PROFILE_QUIRKS)
+#define QUIRK_LOAD_STORE_INC_I QUIRK_GET(QUIRK_1, PROFILE_QUIRKS)
+#define QUIRK_JUMP_VX          QUIRK_GET(QUIRK_2, PROFILE_QUIRKS)
+#define QUIRK_CLIP_SPRITES     QUIRK_GET(QUIRK_3, PROFILE_QUIRKS)
+#define QUIRK_VF_RESET         QUIRK_GET(QUIRK_4, PROFILE_QUIRKS)
+#define QUIRK_ADD_I_VF         QUIRK_GET(QUIRK_5, PROFILE_QUIRKS)
+#define QUIRK_SCHIP            QUIRK_GET(QUIRK_6, PROFILE_QUIRKS)
+#define QUIRK_XOCHIP           QUIRK_GET(QUIRK_7, PROFILE_QUIRKS)
+
+#define PROFILE default
+#include "chip8profile.inc"
+
+#define PROFILE cosmac
+#include "chip8profile.inc"
+
+#define PROFILE schip
+#include "chip8profile.inc"
+
+#define PROFILE xochip
+#include "chip8profile.inc"
+
+#define PROFILE custom
+#include "chip8profile.inc"
+
+struct chip8_profile_info {
+    const char *name;
+    struct chip8_quirks quirks;
+
+    //indexed by enum chip8_dispatch
+    bool (*cycle[CHIP8_DISPATCH_COUNT])(struct chip8 *chip8, unsigned int *events);
+    unsigned int (*run_cycles[CHIP8_DISPATCH_COUNT])(struct chip8 *chip8, unsigned int count);
+};
+
+#define PROFILE_INFO(profile) \
+    { \
+        #profile, \
+        {CHIP8_QUIRKS_##profile}, \
+        {chip8_##profile##_switch_cycle, chip8_##profile##_table_cycle, chip8_##profile##_threaded_cycle}, \
+        {chip8_##profile##_switch_run_cycles, chip8_##profile##_table_run_cycles, chip8_##profile##_threaded_run_cycles} \
+    },
+
+//indexed by enum chip8_profile
+static const struct chip8_profile_info profiles[CHIP8_PROFILE_COUNT] = {
+    CHIP8_PROFILES(PROFILE_INFO)
+};
+
+//executes a single instruction, OR'ing any events it raises into events
+//returns false if the opcode is not handled, in which case the machine should be stopped
+bool
+chip8_cycle(struct chip8 *chip8, unsigned int *events) {
+    return profiles[chip8->profile].cycle[chip8->dispatch](chip8, events);
+}
+
+//runs up to count instructions and returns the events raised along the way
+//the batch ends early if the machine halts on an unhandled opcode or starts waiting for a key
+unsigned int
+chip8_run_cycles(struct chip8 *chip8, unsigned int count) {
+    return profiles[chip8->profile].run_cycles[chip8->dispatch](chip8, count);
+}
+
+//the memory size, display and fonts follow the new profile from the next load or reset
+bool
+chip8_set_profile(struct chip8 *chip8, enum chip8_profile profile) {
+    if (profile < 0 || profile >= CHIP8_PROFILE_COUNT) {
+        return false;
+    }
+
+    chip8->profile = profile;
+    return true;
+}
+
+const char *
+chip8_profile_name(enum chip8_profile profile) {
+    if (profile < 0 || profile >= CHIP8_PROFILE_COUNT) {
+        return NULL;
+    }
+
+    return profiles[profile].name;
+}
+
+bool
+chip8_profile_find(const char *name, enum chip8_profile *profile) {
+    int i;
+
+    for (i = 0; i < CHIP8_PROFILE_COUNT; i++) {
+        if (strcmp(profiles[i].name, name) == 0) {
+            *profile = i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static const char *dispatch_names[CHIP8_DISPATCH_COUNT] = {
+    "switch",
+    "table",
+    "threaded"
+};
+
+bool
+chip8_set_dispatch(struct chip8 *chip8, enum chip8_dispatch dispatch) {
+    if (dispatch < 0 || dispatch >= CHIP8_DISPATCH_COUNT) {
+        return false;
+    }
+
+    chip8->dispatch = dispatch;
+    return true;
+}
+
+const char *
+chip8_dispatch_name(enum chip8_dispatch dispatch) {
+    if (dispatch < 0 || dispatch >= CHIP8_DISPATCH_COUNT) {
+        return NULL;
+    }
+
+    return dispatch_names[dispatch];
+}
+
+bool
+chip8_dispatch_find(const char *name, enum chip8_dispatch *dispatch) {
+    int i;
+
+    for (i = 0; i < CHIP8_DISPATCH_COUNT; i++) {
+        if (strcmp(dispatch_names[i], name) == 0) {
+            *dispatch = i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+const struct chip8_quirks *
+chip8_profile_quirks(enum chip8_profile profile) {
+    if (profile < 0 || profile >= CHIP8_PROFILE_COUNT) {
+        return NULL;
+    }
+
+    return &profiles[profile].quirks;
+}
+
+//counts the delay timer and sound timer down once, should be called at 60Hz
+unsigned int
+chip8_tick_timers(struct chip8 *chip8) {
+    unsigned int events = 0;
+
+    if (chip8->dt > 0) {
+        --chip8->dt;
+    }
+
+    if (chip8->st > 0) {
+        if (chip8->st == 1) {
+            events |= CHIP8_EVENT_SOUND_OFF;
+        }
+        --chip8->st;
+    }
+
+    return events;
+}
+
+void
+chip8_snapshot(const struct chip8 *chip8, struct chip8_snapshot *snapshot) {
+    snapshot->I = chip8->I;
+    snapshot->pc = chip8->pc;
+    snapshot->opcode = chip8->opcode;
+    snapshot->sp = chip8->sp;
+    snapshot->dt = chip8->dt;
+    snapshot->st = chip8->st;
+    memcpy(snapshot->V, chip8->V, sizeof(snapshot->V));
+    memcpy(snapshot->stack, chip8->stack, sizeof(snapshot->stack));
+
+    memcpy(snapshot->gfx, chip8->gfx, sizeof(snapshot->gfx));
+    snapshot->gfx_width = chip8->gfx_width;
+    snapshot->gfx_height = chip8->gfx_height;
+    snapshot->gfx_dirty = chip8->gfx_dirty;
+    snapshot->planes = chip8->planes;
+
+    memcpy(snapshot->flags, chip8->flags, sizeof(snapshot->flags));
+    memcpy(snapshot->audio_pattern, chip8->audio_pattern, sizeof(snapshot->audio_pattern));
+    snapshot->pitch = chip8->pitch;
+    snapshot->rng = chip8->rng;
+    snapshot->cycles = chip8->cycles;
+    snapshot->sound_on_cycle = chip8->sound_on_cycle;
+    snapshot->sound_off_cycle = chip8->sound_off_cycle;
+
+    //every access wraps to memory_size, so nothing past it can have changed
+    snapshot->memory_size = chip8->memory_size;
+    memcpy(snapshot->memory, chip8->memory, chip8->memory_size);
+}
+
+void
+chip8_restore(struct chip8 *chip8, const struct chip8_snapshot *snapshot) {
+    chip8->I = snapshot->I;
+    chip8->pc = snapshot->pc;
+    chip8->opcode = snapshot->opcode;
+    chip8->sp = snapshot->sp;
+    chip8->dt = snapshot->dt;
+    chip8->st = snapshot->st;
+    memcpy(chip8->V, snapshot->V, sizeof(chip8->V));
+    memcpy(chip8->stack, snapshot->stack, sizeof(chip8->stack));
+
+    memcpy(chip8->gfx, snapshot->gfx, sizeof(chip8->gfx));
+    chip8->gfx_width = snapshot->gfx_width;
+    chip8->gfx_height = snapshot->gfx_height;
+    chip8->gfx_dirty = snapshot->gfx_dirty;
+    chip8->planes = snapshot->planes;
+
+    memcpy(chip8->flags, snapshot->flags, sizeof(chip8->flags));
+    memcpy(chip8->audio_pattern, snapshot->audio_pattern, sizeof(chip8->audio_pattern));
+    chip8->pitch = snapshot->pitch;
+    chip8->rng = snapshot->rng;
+    chip8->cycles = snapshot->cycles;
+    chip8->sound_on_cycle = snapshot->sound_on_cycle;
+    chip8->sound_off_cycle = snapshot->sound_off_cycle;
+
+    chip8->memory_size = snapshot->memory_size;
+    memcpy(chip8->memory, snapshot->memory, snapshot->memory_size);
+}
+
+//the first plane's rows, see struct chip8 for the layout
+const uint64_t *
+chip8_gfx(const struct chip8 *chip8) {
+    return chip8->gfx[0][0];
+}
+
+//the pixel at (x, y) of the current resolution, bit p is set if it's lit on plane p
+unsigned int
+chip8_pixel(const struct chip8 *chip8, unsigned int x, unsigned int y) {
+    unsigned int p, pixel = 0;
+    uint64_t word;
+
+    for (p = 0; p < CHIP8_GFX_PLANES; p++) {
+        word = chip8->gfx[p][y][x / 64];
+        pixel |= ((word >> (63 - x % 64)) & 1) << p;
+    }
+
+    return pixel;
+}
+
+unsigned char *
+chip8_keys(struct chip8 *chip8) {
+    return chip8->key;
+}
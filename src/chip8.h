@@ -0,0 +1,212 @@
+#ifndef CHIP8_H
+#define CHIP8_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+//the low resolution display every profile starts in
+#define CHIP8_GFX_WIDTH  64
+#define CHIP8_GFX_HEIGHT 32
+
+//the SUPER-CHIP high resolution display, the framebuffer is always allocated at this size
+#define CHIP8_GFX_MAX_WIDTH  128
+#define CHIP8_GFX_MAX_HEIGHT 64
+
+//XO-CHIP bitplanes, and the 64 bit words making up one framebuffer row
+#define CHIP8_GFX_PLANES 2
+#define CHIP8_GFX_WORDS  (CHIP8_GFX_MAX_WIDTH / 64)
+
+//memory of a classic machine, and of an XO-CHIP one
+#define CHIP8_MEMORY_SIZE 4096
+#define CHIP8_MEMORY_MAX  65536
+#define CHIP8_PROGRAM_START 0x200
+
+//nested 2NNN calls before the machine halts with a stack overflow
+#define CHIP8_STACK_DEPTH 16
+
+//events returned by chip8_run_cycles() and chip8_tick_timers(), OR'd together
+#define CHIP8_EVENT_FRAME     0x01 //the framebuffer changed and should be redrawn
+#define CHIP8_EVENT_SOUND_ON  0x02 //the sound timer went from zero to non-zero
+#define CHIP8_EVENT_SOUND_OFF 0x04 //the sound timer counted down to zero
+#define CHIP8_EVENT_KEY_WAIT  0x08 //FX0A is blocking until a key is pressed
+#define CHIP8_EVENT_UNHANDLED 0x10 //an unknown opcode was hit, the machine is halted
+#define CHIP8_EVENT_EXIT      0x20 //00FD asked the interpreter to exit, the machine is halted
+
+//compatibility profiles, each one is a separately compiled copy of the interpreter
+enum chip8_profile {
+    CHIP8_PROFILE_DEFAULT, //what this emulator has always done
+    CHIP8_PROFILE_COSMAC,  //the original COSMAC VIP interpreter
+    CHIP8_PROFILE_SCHIP,   //SUPER-CHIP 1.1
+    CHIP8_PROFILE_XOCHIP,  //XO-CHIP, SUPER-CHIP plus bitplanes and 64KB of memory
+    CHIP8_PROFILE_CUSTOM,  //chosen at build time with the CHIP8_CUSTOM_* defines
+    CHIP8_PROFILE_COUNT
+};
+
+//how an instruction is decoded, every strategy gives exactly the same results
+enum chip8_dispatch {
+    CHIP8_DISPATCH_SWITCH,   //nested switch on the opcode's nibbles
+    CHIP8_DISPATCH_TABLE,    //65,536 entry table of handler indices generated at build time by gendispatch
+    CHIP8_DISPATCH_THREADED, //computed goto, every handler jumps straight to the next opcode's handler
+    CHIP8_DISPATCH_COUNT
+};
+
+//the behaviour a profile was compiled with
+struct chip8_quirks {
+    bool shift_vy;         //8XY6/8XYE shift VY into VX instead of shifting VX in place
+    bool load_store_inc_i; //FX55/FX65 leave I pointing past the last register copied
+    bool jump_vx;          //BXNN jumps to XNN + VX instead of BNNN jumping to NNN + V0
+    bool clip_sprites;     //sprites are clipped at the screen edges instead of wrapping around
+    bool vf_reset;         //8XY1/8XY2/8XY3 reset VF to 0
+    bool add_i_vf;         //FX1E sets VF to 1 when I + VX passes 0xFFF and to 0 when it doesn't
+    bool schip;            //SUPER-CHIP opcodes: hi-res mode, scrolling, 16x16 sprites, big font and flags
+    bool xochip;           //XO-CHIP opcodes: bitplanes, 00DN, 5XY2/5XY3, F000 NNNN, audio and 64KB of memory
+};
+
+struct chip8;
+
+//optional hooks so the embedding program can see what the core is doing
+struct chip8_callbacks {
+    //a line of text, such as an unhandled opcode message
+    void (*log)(void *ctx, const char *msg);
+
+    //called before and after every instruction with state "Before Handler" and "After Handler"
+    void (*trace)(void *ctx, const struct chip8 *chip8, const char *state);
+
+    void *ctx;
+};
+
+struct chip8 {
+    //index register
+    uint16_t I;
+
+    //program counter
+    uint16_t pc;
+
+    //current opcode being processed
+    uint16_t opcode;
+
+    //stack pointer
+    uint8_t sp;
+
+    //delay timer and sound timer, counted down at 60Hz by chip8_tick_timers()
+    uint8_t dt;
+    uint8_t st;
+
+    //only the first memory_size bytes are used, set from the profile on reset
+    unsigned char memory[CHIP8_MEMORY_MAX];
+    uint32_t memory_size;
+
+    //15 CPU registers, with the 16th one used for the carry flag
+    unsigned char V[16];
+
+    uint16_t stack[CHIP8_STACK_DEPTH];
+
+    //represents what's currently being displayed, packed one bit per pixel
+    //every row is CHIP8_GFX_WORDS words with the leftmost pixel in the high bit of the first word,
+    //in low resolution only the first gfx_height rows and the first word of each are used
+    uint64_t gfx[CHIP8_GFX_PLANES][CHIP8_GFX_MAX_HEIGHT][CHIP8_GFX_WORDS];
+    uint8_t gfx_width;
+    uint8_t gfx_height;
+
+    //bit y is set when row y changed, the embedding program clears it once it has redrawn
+    uint64_t gfx_dirty;
+
+    //bitplanes drawn to, cleared and scrolled by the next instructions, set by FN01
+    uint8_t planes;
+
+    //SUPER-CHIP RPL user flags saved by FX75, kept across loads and resets
+    unsigned char flags[16];
+
+    //XO-CHIP audio pattern loaded by F002 and pitch set by FX3A
+    unsigned char audio_pattern[16];
+    uint8_t pitch;
+
+    //currently pressed keys, written directly by the embedding program
+    unsigned char key[16];
+
+    //state of the CXNN random number generator
+    uint32_t rng;
+
+    //which copy of the interpreter runs this machine and how it decodes, kept across loads and resets
+    enum chip8_profile profile;
+    enum chip8_dispatch dispatch;
+
+    //total number of instructions executed since the last reset
+    uint64_t cycles;
+
+    //the value of cycles right after the last FX18 that switched the sound timer on, and the last
+    //one that switched it off, so the tone can be placed at the instruction within a run of many
+    uint64_t sound_on_cycle;
+    uint64_t sound_off_cycle;
+
+    //the ROM as it was loaded, so chip8_reset() can restore it
+    size_t rom_size;
+    unsigned char rom[CHIP8_MEMORY_MAX - CHIP8_PROGRAM_START];
+
+    struct chip8_callbacks callbacks;
+};
+
+//everything an instruction or a timer tick can change, saved by chip8_snapshot() and put back by
+//chip8_restore() so a machine can be run ahead and rewound; the keys, ROM, profile and callbacks
+//belong to the embedding program and are left alone
+struct chip8_snapshot {
+    uint16_t I;
+    uint16_t pc;
+    uint16_t opcode;
+    uint8_t sp;
+    uint8_t dt;
+    uint8_t st;
+    unsigned char V[16];
+    uint16_t stack[CHIP8_STACK_DEPTH];
+
+    uint64_t gfx[CHIP8_GFX_PLANES][CHIP8_GFX_MAX_HEIGHT][CHIP8_GFX_WORDS];
+    uint8_t gfx_width;
+    uint8_t gfx_height;
+    uint64_t gfx_dirty;
+    uint8_t planes;
+
+    unsigned char flags[16];
+    unsigned char audio_pattern[16];
+    uint8_t pitch;
+    uint32_t rng;
+    uint64_t cycles;
+    uint64_t sound_on_cycle;
+    uint64_t sound_off_cycle;
+
+    //only the first memory_size bytes are saved, 4KB unless the profile is XO-CHIP
+    uint32_t memory_size;
+    unsigned char memory[CHIP8_MEMORY_MAX];
+};
+
+struct chip8 *chip8_create();
+void chip8_destroy(struct chip8 *chip8);
+
+void chip8_set_callbacks(struct chip8 *chip8, const struct chip8_callbacks *callbacks);
+void chip8_seed(struct chip8 *chip8, uint32_t seed);
+
+bool chip8_set_profile(struct chip8 *chip8, enum chip8_profile profile);
+const char *chip8_profile_name(enum chip8_profile profile);
+bool chip8_profile_find(const char *name, enum chip8_profile *profile);
+const struct chip8_quirks *chip8_profile_quirks(enum chip8_profile profile);
+
+bool chip8_set_dispatch(struct chip8 *chip8, enum chip8_dispatch dispatch);
+const char *chip8_dispatch_name(enum chip8_dispatch dispatch);
+bool chip8_dispatch_find(const char *name, enum chip8_dispatch *dispatch);
+
+bool chip8_load(struct chip8 *chip8, const char *path);
+bool chip8_load_mem(struct chip8 *chip8, const unsigned char *rom, size_t size);
+void chip8_reset(struct chip8 *chip8);
+
+bool chip8_cycle(struct chip8 *chip8, unsigned int *events);
+unsigned int chip8_run_cycles(struct chip8 *chip8, unsigned int count);
+unsigned int chip8_tick_timers(struct chip8 *chip8);
+
+void chip8_snapshot(const struct chip8 *chip8, struct chip8_snapshot *snapshot);
+void chip8_restore(struct chip8 *chip8, const struct chip8_snapshot *snapshot);
+
+const uint64_t *chip8_gfx(const struct chip8 *chip8);
+unsigned int chip8_pixel(const struct chip8 *chip8, unsigned int x, unsigned int y);
+unsigned char *chip8_keys(struct chip8 *chip8);
+
+#endif
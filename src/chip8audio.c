@@ -0,0 +1,302 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include "chip8audio.h"
+
+//the buzzer every profile without XO-CHIP audio gets
+#define TONE_HZ 440
+
+#define AMPLITUDE 8000
+
+//sound timer changes remembered within one tick, any more than that land at the end of it
+#define MAX_EDGES 16
+
+#define WAV_HEADER_SIZE 44
+
+//the tone switching on or off at an instruction
+struct chip8_audio_edge {
+    uint64_t cycle;
+    bool on;
+};
+
+struct chip8_audio {
+    unsigned int rate;
+
+    FILE *sink;
+    bool pipe;
+    bool wav;
+    uint64_t wav_samples;
+
+    //samples rendered since the last flush
+    int16_t *samples;
+    size_t count;
+    size_t chunk;
+    size_t capacity;
+
+    //whether the tone was on at the start of the current tick and after the last update,
+    //plus where it changed in between
+    bool start_on;
+    bool on;
+    uint64_t tick_cycle;
+    uint64_t update_cycle;
+    struct chip8_audio_edge edges[MAX_EDGES];
+    unsigned int edges_count;
+
+    //a full turn of the phase is one period of the tone, or one pass over the XO-CHIP pattern
+    uint32_t phase;
+
+    //rate / 60 isn't whole for every rate, this carries the leftover between ticks
+    unsigned int remainder;
+};
+
+static void
+put16(unsigned char *p, uint16_t v) {
+    p[0] = v & 0xFF;
+    p[1] = v >> 8;
+}
+
+static void
+put32(unsigned char *p, uint32_t v) {
+    put16(p, v & 0xFFFF);
+    put16(p + 2, v >> 16);
+}
+
+//a 16 bit mono PCM header, the sizes are filled in when the file is closed
+static bool
+write_wav_header(FILE *f, unsigned int rate, uint64_t samples) {
+    unsigned char header[WAV_HEADER_SIZE];
+    uint32_t data = samples * sizeof(int16_t);
+
+    memcpy(header, "RIFF", 4);
+    put32(header + 4, 36 + data);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    put32(header + 16, 16);
+    put16(header + 20, 1);
+    put16(header + 22, 1);
+    put32(header + 24, rate);
+    put32(header + 28, rate * sizeof(int16_t));
+    put16(header + 32, sizeof(int16_t));
+    put16(header + 34, 16);
+    memcpy(header + 36, "data", 4);
+    put32(header + 40, data);
+
+    return fwrite(header, sizeof(header), 1, f) == 1;
+}
+
+struct chip8_audio *
+chip8_audio_create(unsigned int rate, unsigned int chunk_ticks) {
+    struct chip8_audio *audio;
+
+    if (rate == 0) {
+        rate = CHIP8_AUDIO_DEFAULT_RATE;
+    }
+    if (chunk_ticks == 0) {
+        chunk_ticks = CHIP8_AUDIO_DEFAULT_CHUNK_TICKS;
+    }
+
+    audio = calloc(1, sizeof(*audio));
+    if (audio == NULL) {
+        return NULL;
+    }
+
+    audio->rate = rate;
+    audio->chunk = (size_t)chunk_ticks * rate / 60;
+
+    //room for one more tick than the chunk, so a tick never has to be split
+    audio->capacity = audio->chunk + rate / 60 + 1;
+    audio->samples = malloc(audio->capacity * sizeof(*audio->samples));
+    if (audio->samples == NULL) {
+        free(audio);
+        return NULL;
+    }
+
+    return audio;
+}
+
+static void
+chip8_audio_close(struct chip8_audio *audio) {
+    if (audio->sink == NULL) {
+        return;
+    }
+
+    chip8_audio_flush(audio);
+
+    if (audio->pipe) {
+        pclose(audio->sink);
+    }
+    else {
+        //now that the length is known, go back and fix up the header
+        if (audio->wav && fseek(audio->sink, 0, SEEK_SET) == 0) {
+            write_wav_header(audio->sink, audio->rate, audio->wav_samples);
+        }
+
+        fclose(audio->sink);
+    }
+
+    audio->sink = NULL;
+}
+
+void
+chip8_audio_destroy(struct chip8_audio *audio) {
+    if (audio == NULL) {
+        return;
+    }
+
+    chip8_audio_close(audio);
+    free(audio->samples);
+    free(audio);
+}
+
+//writes everything to a WAV file at path
+bool
+chip8_audio_open_wav(struct chip8_audio *audio, const char *path) {
+    chip8_audio_close(audio);
+
+    audio->sink = fopen(path, "wb");
+    if (audio->sink == NULL) {
+        return false;
+    }
+
+    audio->pipe = false;
+    audio->wav = true;
+    audio->wav_samples = 0;
+
+    return write_wav_header(audio->sink, audio->rate, 0);
+}
+
+//writes raw 16 bit little endian mono samples to the standard input of command,
+//e.g. "aplay -q -f S16_LE -r 44100" to hear it
+bool
+chip8_audio_open_pipe(struct chip8_audio *audio, const char *command) {
+    chip8_audio_close(audio);
+
+    audio->sink = popen(command, "w");
+    if (audio->sink == NULL) {
+        return false;
+    }
+
+    audio->pipe = true;
+    audio->wav = false;
+
+    return true;
+}
+
+static void
+chip8_audio_edge(struct chip8_audio *audio, uint64_t cycle, bool on) {
+    if (on == audio->on) {
+        return;
+    }
+
+    if (audio->edges_count < MAX_EDGES) {
+        audio->edges[audio->edges_count].cycle = cycle;
+        audio->edges[audio->edges_count].on = on;
+        ++audio->edges_count;
+    }
+
+    audio->on = on;
+}
+
+//notes where the sound timer was switched on or off, call after running instructions
+void
+chip8_audio_update(struct chip8_audio *audio, const struct chip8 *chip8) {
+    uint64_t on_cycle = chip8->sound_on_cycle, off_cycle = chip8->sound_off_cycle;
+    bool on_new = on_cycle > audio->update_cycle, off_new = off_cycle > audio->update_cycle;
+
+    //the machine remembers the last FX18 in each direction, so both can be placed in the order they ran
+    if (on_new && off_new && off_cycle < on_cycle) {
+        chip8_audio_edge(audio, off_cycle, false);
+        chip8_audio_edge(audio, on_cycle, true);
+    }
+    else {
+        if (on_new) {
+            chip8_audio_edge(audio, on_cycle, true);
+        }
+        if (off_new) {
+            chip8_audio_edge(audio, off_cycle, false);
+        }
+    }
+
+    //anything else, like a restore or a reset, lands where the run ended
+    chip8_audio_edge(audio, chip8->cycles, chip8->st > 0);
+    audio->update_cycle = chip8->cycles;
+}
+
+//renders the 60Hz tick that just ended, call right after chip8_tick_timers()
+void
+chip8_audio_tick(struct chip8_audio *audio, const struct chip8 *chip8) {
+    const struct chip8_quirks *quirks = chip8_profile_quirks(chip8->profile);
+    unsigned int n, i, e = 0, bit;
+    uint64_t cycles = chip8->cycles >= audio->tick_cycle ? chip8->cycles - audio->tick_cycle : 0;
+    uint32_t step;
+    int16_t *out;
+    bool on = audio->start_on;
+
+    n = (audio->rate + audio->remainder) / 60;
+    audio->remainder = (audio->rate + audio->remainder) % 60;
+
+    //XO-CHIP plays its 128 bit pattern at 4000 * 2^((pitch - 64) / 48) bits per second
+    if (quirks->xochip) {
+        step = 4000.0 * exp2((chip8->pitch - 64) / 48.0) / 128.0 * 4294967296.0 / audio->rate;
+    }
+    else {
+        step = (uint64_t)TONE_HZ * 4294967296ULL / audio->rate;
+    }
+
+    out = audio->samples + audio->count;
+    for (i = 0; i < n; i++) {
+        //an edge takes effect at the sample its cycle falls on within the tick
+        while (e < audio->edges_count &&
+               (cycles == 0 || (audio->edges[e].cycle - audio->tick_cycle) * n / cycles <= i)) {
+            on = audio->edges[e++].on;
+        }
+
+        if (!on) {
+            out[i] = 0;
+            continue;
+        }
+
+        if (quirks->xochip) {
+            bit = audio->phase >> 25;
+            out[i] = (chip8->audio_pattern[bit / 8] >> (7 - bit % 8)) & 1 ? AMPLITUDE : -AMPLITUDE;
+        }
+        else {
+            out[i] = audio->phase & 0x80000000 ? AMPLITUDE : -AMPLITUDE;
+        }
+
+        audio->phase += step;
+    }
+
+    audio->count += n;
+
+    //the timers have already counted down, so the next tick starts from the current state
+    audio->start_on = audio->on = chip8->st > 0;
+    audio->tick_cycle = chip8->cycles;
+    audio->edges_count = 0;
+
+    if (audio->count >= audio->chunk) {
+        chip8_audio_flush(audio);
+    }
+}
+
+//writes out everything rendered so far in one go
+//with no sink the samples are dropped
+bool
+chip8_audio_flush(struct chip8_audio *audio) {
+    bool success = true;
+
+    if (audio->sink != NULL && audio->count > 0) {
+        success = fwrite(audio->samples, sizeof(*audio->samples), audio->count, audio->sink) == audio->count;
+        audio->wav_samples += audio->count;
+
+        if (audio->pipe) {
+            fflush(audio->sink);
+        }
+    }
+
+    audio->count = 0;
+
+    return success;
+}
@@ -0,0 +1,33 @@
+#ifndef CHIP8AUDIO_H
+#define CHIP8AUDIO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "chip8.h"
+
+//16 bit signed mono samples at this rate unless asked otherwise
+#define CHIP8_AUDIO_DEFAULT_RATE 44100
+
+//60Hz ticks buffered before the samples are written out, 6 is 100ms
+#define CHIP8_AUDIO_DEFAULT_CHUNK_TICKS 6
+
+//renders what a machine's sound timer is doing into PCM in emulated time
+//the tone is switched on and off at the FX18 that changed the sound timer, placed within the
+//60Hz tick by the cycle count the machine recorded for it, so the output stays in sync with the
+//emulation however fast it is run and the sink only sees a write every chunk of ticks; only the
+//last FX18 each way is kept between updates, so calling chip8_audio_update() once per run of
+//instructions is enough unless a program toggles the sound more than that within one
+struct chip8_audio;
+
+struct chip8_audio *chip8_audio_create(unsigned int rate, unsigned int chunk_ticks);
+void chip8_audio_destroy(struct chip8_audio *audio);
+
+bool chip8_audio_open_wav(struct chip8_audio *audio, const char *path);
+bool chip8_audio_open_pipe(struct chip8_audio *audio, const char *command);
+
+void chip8_audio_update(struct chip8_audio *audio, const struct chip8 *chip8);
+void chip8_audio_tick(struct chip8_audio *audio, const struct chip8 *chip8);
+bool chip8_audio_flush(struct chip8_audio *audio);
+
+#endif
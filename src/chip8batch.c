@@ -0,0 +1,924 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "chip8batch.h"
+
+#define LANES CHIP8_BATCH_LANES
+
+//picks a where the mask is all ones and b where it is all zeros
+#define SELECT(m, a, b) (((a) & (m)) | ((b) & ~(m)))
+
+//widens a 0x00/0xFF lane mask to 16 or 32 bits
+#define MASK16(m) ((uint16_t)(int8_t)(m))
+#define MASK32(m) ((uint32_t)(int8_t)(m))
+
+//calls to chip8_batch_run_cycles() that skip lock-step after the lanes are seen to diverge,
+//doubled up to the maximum each time they're still apart when it's retried
+#define DIVERGED_BACKOFF     8
+#define DIVERGED_BACKOFF_MAX 64
+
+//once the lanes have split into more groups than lanes / LOCKSTEP_GROUP_MIN, running
+//each lane on its own is cheaper than a pass per group
+#define LOCKSTEP_GROUP_MIN 8
+
+//build an AVX2 and a baseline copy of the vector handlers and pick one at load time
+#if defined(__GNUC__) && defined(__x86_64__) && !defined(__clang__)
+#define VECTOR_CLONES __attribute__((target_clones("avx2", "default")))
+#else
+#define VECTOR_CLONES
+#endif
+
+struct chip8_batch *
+chip8_batch_create(unsigned int lanes) {
+    struct chip8_batch *batch;
+    unsigned int l;
+
+    if (lanes == 0 || lanes > LANES) {
+        return NULL;
+    }
+
+    batch = calloc(1, sizeof(*batch));
+    if (batch == NULL) {
+        return NULL;
+    }
+
+    batch->lanes = lanes;
+    for (l = 0; l < lanes; l++) {
+        batch->machines[l] = chip8_create();
+        if (batch->machines[l] == NULL) {
+            chip8_batch_destroy(batch);
+            return NULL;
+        }
+
+        //give every lane its own random stream
+        chip8_seed(batch->machines[l], l + 1);
+    }
+
+    chip8_batch_gather(batch);
+
+    return batch;
+}
+
+void
+chip8_batch_destroy(struct chip8_batch *batch) {
+    unsigned int l;
+
+    if (batch == NULL) {
+        return;
+    }
+
+    for (l = 0; l < batch->lanes; l++) {
+        chip8_destroy(batch->machines[l]);
+    }
+
+    free(batch);
+}
+
+//the lane's registers are only up to date after chip8_batch_scatter()
+//and changes made to them or to its memory only take effect after chip8_batch_gather()
+struct chip8 *
+chip8_batch_lane(struct chip8_batch *batch, unsigned int lane) {
+    return lane < batch->lanes ? batch->machines[lane] : NULL;
+}
+
+bool
+chip8_batch_load_mem(struct chip8_batch *batch, const unsigned char *rom, size_t size) {
+    unsigned int l;
+
+    for (l = 0; l < batch->lanes; l++) {
+        if (!chip8_load_mem(batch->machines[l], rom, size)) {
+            return false;
+        }
+    }
+
+    chip8_batch_gather(batch);
+
+    return true;
+}
+
+void
+chip8_batch_reset(struct chip8_batch *batch) {
+    unsigned int l;
+
+    for (l = 0; l < batch->lanes; l++) {
+        chip8_reset(batch->machines[l]);
+    }
+
+    chip8_batch_gather(batch);
+}
+
+static void
+chip8_batch_gather_lane(struct chip8_batch *batch, unsigned int l) {
+    const struct chip8 *chip8 = batch->machines[l];
+    int i;
+
+    for (i = 0; i < 16; i++) {
+        batch->V[i][l] = chip8->V[i];
+    }
+
+    batch->I[l] = chip8->I;
+    batch->pc[l] = chip8->pc;
+    batch->dt[l] = chip8->dt;
+    batch->st[l] = chip8->st;
+    batch->rng[l] = chip8->rng;
+    batch->cycles[l] = chip8->cycles;
+    batch->memory[l] = chip8->memory;
+    batch->wrap[l] = chip8->memory_size - 1;
+}
+
+static void
+chip8_batch_scatter_lane(struct chip8_batch *batch, unsigned int l) {
+    struct chip8 *chip8 = batch->machines[l];
+    int i;
+
+    for (i = 0; i < 16; i++) {
+        chip8->V[i] = batch->V[i][l];
+    }
+
+    chip8->I = batch->I[l];
+    chip8->pc = batch->pc[l];
+    chip8->dt = batch->dt[l];
+    chip8->st = batch->st[l];
+    chip8->rng = batch->rng[l];
+    chip8->cycles = batch->cycles[l];
+}
+
+//pulls every lane's registers into the batch and marks all lanes as running
+void
+chip8_batch_gather(struct chip8_batch *batch) {
+    unsigned int l;
+
+    memset(batch->running, 0, sizeof(batch->running));
+    memset(batch->events, 0, sizeof(batch->events));
+    batch->backoff = 0;
+    batch->backoff_next = DIVERGED_BACKOFF;
+    batch->scattered = false;
+    batch->default_profile = true;
+    batch->long_skips = false;
+    ++batch->generation;
+
+    for (l = 0; l < batch->lanes; l++) {
+        chip8_batch_gather_lane(batch, l);
+        batch->running[l] = 0xFF;
+
+        if (batch->machines[l]->profile != CHIP8_PROFILE_DEFAULT) {
+            batch->default_profile = false;
+        }
+
+        if (chip8_profile_quirks(batch->machines[l]->profile)->xochip) {
+            batch->long_skips = true;
+        }
+
+        batch->add_i_vf[l] = chip8_profile_quirks(batch->machines[l]->profile)->add_i_vf ? 0xFF : 0x00;
+        batch->load_store_inc_i[l] = chip8_profile_quirks(batch->machines[l]->profile)->load_store_inc_i ? 0xFF : 0x00;
+    }
+}
+
+//pushes the batch registers back out to every lane's machine
+void
+chip8_batch_scatter(struct chip8_batch *batch) {
+    unsigned int l;
+
+    //the machines already hold them
+    if (batch->scattered) {
+        return;
+    }
+
+    for (l = 0; l < batch->lanes; l++) {
+        chip8_batch_scatter_lane(batch, l);
+    }
+}
+
+//executes one instruction on a single lane using the reference interpreter
+//a lane that starts waiting for a key sits out the rest of the call, like chip8_run_cycles() does
+static void
+chip8_batch_scalar(struct chip8_batch *batch, unsigned int l) {
+    struct chip8 *chip8 = batch->machines[l];
+    uint16_t wrap = batch->wrap[l], pc = batch->pc[l];
+    uint16_t opcode = batch->memory[l][pc & wrap] << 8 | batch->memory[l][(pc + 1) & wrap];
+
+    //FX33, FX55 and XO-CHIP's 5XY2 are the only instructions that write to memory
+    if ((opcode & 0xF0FF) == 0xF033 || (opcode & 0xF0FF) == 0xF055 || (opcode & 0xF00F) == 0x5002) {
+        ++batch->generation;
+    }
+
+    chip8_batch_scatter_lane(batch, l);
+
+    if (!chip8_cycle(chip8, &batch->events[l])) {
+        batch->running[l] = 0x00;
+        batch->active[l] = 0x00;
+    }
+    else if (batch->events[l] & CHIP8_EVENT_KEY_WAIT) {
+        batch->active[l] = 0x00;
+    }
+
+    chip8_batch_gather_lane(batch, l);
+}
+
+//executes opcode on every lane in mask one lane at a time, for the opcodes that need a lane's
+//stack, keys, memory or framebuffer but are too common to count as the lanes diverging
+//returns false if the opcode isn't one of them, in which case nothing was touched
+static bool
+chip8_batch_lanes(struct chip8_batch *batch, uint16_t opcode, const uint8_t *mask) {
+    struct chip8 *chip8;
+    unsigned char *memory;
+    uint8_t x = (opcode & 0x0F00) >> 8, v;
+    uint16_t wrap, I;
+    unsigned int l, i;
+    bool press;
+
+    switch (opcode & 0xF000) {
+        case 0x0000:
+            if (opcode != 0x00EE) {
+                return false;
+            }
+            break;
+        case 0x2000:
+        case 0xD000:
+            break;
+        case 0xE000:
+            //the skips have to look at the next opcode on XO-CHIP
+            if (batch->long_skips || ((opcode & 0x00FF) != 0x009E && (opcode & 0x00FF) != 0x00A1)) {
+                return false;
+            }
+            break;
+        case 0xF000:
+            switch (opcode & 0x00FF) {
+                case 0x0033:
+                case 0x0055:
+                    //the decoded blocks may hold what these overwrite
+                    ++batch->generation;
+                    break;
+                case 0x0018:
+                case 0x0065:
+                    break;
+                default:
+                    return false;
+            }
+            break;
+        default:
+            return false;
+    }
+
+    for (l = 0; l < batch->lanes; l++) {
+        if (!mask[l]) {
+            continue;
+        }
+
+        chip8 = batch->machines[l];
+
+        switch (opcode & 0xF000) {
+            case 0x0000:
+                //00EE: Return from a subroutine, the stack only lives in the lane's machine
+                if (chip8->sp == 0) {
+                    //let the reference interpreter log the underflow and halt the lane
+                    chip8_batch_scalar(batch, l);
+                    continue;
+                }
+
+                batch->pc[l] = chip8->stack[--chip8->sp] + 2;
+                break;
+            case 0x2000:
+                //2NNN: Execute subroutine starting at address NNN
+                if (chip8->sp == CHIP8_STACK_DEPTH) {
+                    chip8_batch_scalar(batch, l);
+                    continue;
+                }
+
+                chip8->stack[chip8->sp++] = batch->pc[l];
+                batch->pc[l] = opcode & 0x0FFF;
+                break;
+            case 0xD000:
+                //DXYN: the profile's own draw does the work, on the whole lane so that a trace
+                //callback sees every register just as it would stepping the machine on its own
+                chip8_batch_scalar(batch, l);
+                continue;
+            case 0xE000:
+                //EX9E/EXA1: Skip the following instruction if the key in VX is or isn't pressed
+                press = chip8->key[batch->V[x][l] & 0xF] != 0;
+                batch->pc[l] += press == ((opcode & 0x00FF) == 0x009E) ? 4 : 2;
+                break;
+            case 0xF000:
+                memory = chip8->memory;
+                wrap = batch->wrap[l];
+                I = batch->I[l];
+                v = batch->V[x][l];
+
+                switch (opcode & 0x00FF) {
+                    case 0x0018:
+                        //FX18: Sets the sound timer to V[X]
+                        if (batch->st[l] == 0 && v != 0) {
+                            batch->events[l] |= CHIP8_EVENT_SOUND_ON;
+                            chip8->sound_on_cycle = batch->cycles[l] + 1;
+                        }
+                        else if (batch->st[l] != 0 && v == 0) {
+                            chip8->sound_off_cycle = batch->cycles[l] + 1;
+                        }
+
+                        batch->st[l] = v;
+                        break;
+                    case 0x0033:
+                        //FX33: Stores the binary encoded decimal representation of V[X] at the addresses I, I+1, I+2
+                        memory[I & wrap] = v / 100;
+                        memory[(I + 1) & wrap] = (v / 10) % 10;
+                        memory[(I + 2) & wrap] = v % 10;
+                        break;
+                    case 0x0055:
+                        //FX55: Stores V[0] - V[X] in memory starting at address I
+                        for (i = 0; i <= x; i++) {
+                            memory[(I + i) & wrap] = batch->V[i][l];
+                        }
+
+                        batch->I[l] += (x + 1) & MASK16(batch->load_store_inc_i[l]);
+                        break;
+                    case 0x0065:
+                        //FX65: Fills V[0] - V[X] from memory starting at address I
+                        for (i = 0; i <= x; i++) {
+                            batch->V[i][l] = memory[(I + i) & wrap];
+                        }
+
+                        batch->I[l] += (x + 1) & MASK16(batch->load_store_inc_i[l]);
+                        break;
+                }
+
+                batch->pc[l] += 2;
+                break;
+        }
+
+        ++batch->cycles[l];
+    }
+
+    return true;
+}
+
+//executes opcode on every lane in mask at once
+//returns false if the opcode has no vector handler, in which case nothing was touched
+VECTOR_CLONES static bool
+chip8_batch_vector(struct chip8_batch *batch, uint16_t opcode, const uint8_t *mask) {
+    uint8_t *vx = batch->V[(opcode & 0x0F00) >> 8];
+    uint8_t *vf = batch->V[0xF];
+    uint16_t *pc = batch->pc;
+    uint16_t *I = batch->I;
+    uint8_t nn = opcode & 0x00FF;
+    uint16_t nnn = opcode & 0x0FFF;
+    uint8_t m[LANES], x[LANES], y[LANES], dt[LANES], flag[LANES], quirk[LANES];
+    uint32_t rng[LANES], r;
+    unsigned int l;
+
+    //the skips have to look at the next opcode on XO-CHIP, so those lanes take the scalar path
+    if (batch->long_skips && ((opcode & 0xF000) == 0x3000 || (opcode & 0xF000) == 0x4000 ||
+                              (opcode & 0xF000) == 0x5000 || (opcode & 0xF000) == 0x9000)) {
+        return false;
+    }
+
+    //the loops below only read these copies and the element of the array they write, so the
+    //compiler can tell the batch's arrays don't overlap and vectorizes them at -O2
+    memcpy(m, mask, sizeof(m));
+    memcpy(x, vx, sizeof(x));
+    memcpy(y, batch->V[(opcode & 0x00F0) >> 4], sizeof(y));
+    memcpy(dt, batch->dt, sizeof(dt));
+
+    //every loop below runs over all lanes so it has a fixed trip count and vectorizes,
+    //the mask keeps lanes outside the group untouched
+    switch (opcode & 0xF000) {
+        case 0x1000:
+            //1NNN: Jump to address NNN
+            for (l = 0; l < LANES; l++) {
+                pc[l] = SELECT(MASK16(m[l]), nnn, pc[l]);
+            }
+            break;
+        case 0x3000:
+            //3XNN: Skip the following instruction if the value of register VX equals NN
+            for (l = 0; l < LANES; l++) {
+                pc[l] += (2 + ((x[l] == nn) << 1)) & MASK16(m[l]);
+            }
+            break;
+        case 0x4000:
+            //4XNN: Skip the following instruction if the value of register VX is not equal to NN
+            for (l = 0; l < LANES; l++) {
+                pc[l] += (2 + ((x[l] != nn) << 1)) & MASK16(m[l]);
+            }
+            break;
+        case 0x5000:
+            //5XY0: Skip the following instruction if VX equals VY
+            for (l = 0; l < LANES; l++) {
+                pc[l] += (2 + ((x[l] == y[l]) << 1)) & MASK16(m[l]);
+            }
+            break;
+        case 0x6000:
+            //6XNN: Sets V[X] to NN
+            for (l = 0; l < LANES; l++) {
+                vx[l] = SELECT(m[l], nn, x[l]);
+            }
+            for (l = 0; l < LANES; l++) {
+                pc[l] += 2 & MASK16(m[l]);
+            }
+            break;
+        case 0x7000:
+            //7XNN: Adds NN to V[X]
+            for (l = 0; l < LANES; l++) {
+                vx[l] = x[l] + (nn & m[l]);
+            }
+            for (l = 0; l < LANES; l++) {
+                pc[l] += 2 & MASK16(m[l]);
+            }
+            break;
+        case 0x8000:
+            //the logic ops and shifts depend on the quirk profile, only the default profile's are vectorized
+            if (!batch->default_profile && ((opcode & 0x000F) == 0x0001 || (opcode & 0x000F) == 0x0002 ||
+                                            (opcode & 0x000F) == 0x0003 || (opcode & 0x000F) == 0x0006 ||
+                                            (opcode & 0x000F) == 0x000E)) {
+                return false;
+            }
+
+            //VX is worked out from the copies, then the flags are written last so they win when X is F
+            switch (opcode & 0x000F) {
+                case 0x0000:
+                    //8XY0 - Sets VX to the value of VY.
+                    for (l = 0; l < LANES; l++) {
+                        vx[l] = SELECT(m[l], y[l], x[l]);
+                    }
+                    break;
+                case 0x0001:
+                    //8XY1 - Sets VX to (VX OR VY).
+                    for (l = 0; l < LANES; l++) {
+                        vx[l] = x[l] | (y[l] & m[l]);
+                    }
+                    break;
+                case 0x0002:
+                    //8XY2 - Sets VX to (VX AND VY).
+                    for (l = 0; l < LANES; l++) {
+                        vx[l] = x[l] & (y[l] | ~m[l]);
+                    }
+                    break;
+                case 0x0003:
+                    //8XY3 - Sets VX to (VX XOR VY).
+                    for (l = 0; l < LANES; l++) {
+                        vx[l] = x[l] ^ (y[l] & m[l]);
+                    }
+                    break;
+                case 0x0004:
+                    //8XY4 - Adds VY to VX, then VF is set to the carry
+                    for (l = 0; l < LANES; l++) {
+                        flag[l] = x[l] + y[l] > 0xFF;
+                        vx[l] = x[l] + (y[l] & m[l]);
+                    }
+                    break;
+                case 0x0005:
+                    //8XY5 - VY is subtracted from VX, then VF is set to 0 when there was a borrow
+                    for (l = 0; l < LANES; l++) {
+                        flag[l] = x[l] >= y[l];
+                        vx[l] = x[l] - (y[l] & m[l]);
+                    }
+                    break;
+                case 0x0006:
+                    //8XY6 - VX is shifted right by one, then VF is set to the bit shifted out
+                    for (l = 0; l < LANES; l++) {
+                        flag[l] = x[l] & 0x1;
+                        vx[l] = SELECT(m[l], x[l] >> 1, x[l]);
+                    }
+                    break;
+                case 0x0007:
+                    //8XY7 - VX is set to VY minus VX, then VF is set to 0 when there was a borrow
+                    for (l = 0; l < LANES; l++) {
+                        flag[l] = y[l] >= x[l];
+                        vx[l] = SELECT(m[l], (uint8_t)(y[l] - x[l]), x[l]);
+                    }
+                    break;
+                case 0x000E:
+                    //8XYE - VX is shifted left by one, then VF is set to the bit shifted out
+                    for (l = 0; l < LANES; l++) {
+                        flag[l] = x[l] >> 7;
+                        vx[l] = SELECT(m[l], (uint8_t)(x[l] << 1), x[l]);
+                    }
+                    break;
+                default:
+                    return false;
+            }
+
+            if ((opcode & 0x000F) >= 0x0004) {
+                for (l = 0; l < LANES; l++) {
+                    vf[l] = SELECT(m[l], flag[l], vf[l]);
+                }
+            }
+
+            for (l = 0; l < LANES; l++) {
+                pc[l] += 2 & MASK16(m[l]);
+            }
+            break;
+        case 0x9000:
+            //9XY0: Skip the following instruction if VX is not equal to VY
+            for (l = 0; l < LANES; l++) {
+                pc[l] += (2 + ((x[l] != y[l]) << 1)) & MASK16(m[l]);
+            }
+            break;
+        case 0xA000:
+            //ANNN: Sets I to the address NNN
+            for (l = 0; l < LANES; l++) {
+                I[l] = SELECT(MASK16(m[l]), nnn, I[l]);
+                pc[l] += 2 & MASK16(m[l]);
+            }
+            break;
+        case 0xB000:
+            //BNNN: Jumps to NNN + V0, other profiles may jump to XNN + V[X] instead
+            if (!batch->default_profile) {
+                return false;
+            }
+
+            memcpy(y, batch->V[0], sizeof(y));
+            for (l = 0; l < LANES; l++) {
+                pc[l] = SELECT(MASK16(m[l]), nnn + y[l], pc[l]);
+            }
+            break;
+        case 0xC000:
+            //CXNN: Sets VX to a random number masked by NN, each lane's stream is the same xorshift32 as chip8_rand()
+            memcpy(rng, batch->rng, sizeof(rng));
+            for (l = 0; l < LANES; l++) {
+                r = rng[l];
+                r ^= r << 13;
+                r ^= r >> 17;
+                r ^= r << 5;
+                batch->rng[l] = SELECT(MASK32(m[l]), r, rng[l]);
+                vx[l] = SELECT(m[l], r & nn, x[l]);
+            }
+            for (l = 0; l < LANES; l++) {
+                pc[l] += 2 & MASK16(m[l]);
+            }
+            break;
+        case 0xF000:
+            switch (opcode & 0x00FF) {
+                case 0x0007:
+                    //FX07: Sets V[X] to the value of the delay timer
+                    for (l = 0; l < LANES; l++) {
+                        vx[l] = SELECT(m[l], dt[l], x[l]);
+                    }
+                    break;
+                case 0x0015:
+                    //FX15: Sets the delay timer to V[X]
+                    for (l = 0; l < LANES; l++) {
+                        batch->dt[l] = SELECT(m[l], x[l], dt[l]);
+                    }
+                    break;
+                case 0x001E:
+                    //FX1E: V[X] is added to I, then V[F] is set to 1 when there was an overflow on lanes with that quirk
+                    for (l = 0; l < LANES; l++) {
+                        flag[l] = I[l] + x[l] > 0xFFF;
+                        I[l] += x[l] & MASK16(m[l]);
+                    }
+                    memcpy(quirk, batch->add_i_vf, sizeof(quirk));
+                    for (l = 0; l < LANES; l++) {
+                        vf[l] = SELECT(m[l] & quirk[l], flag[l], vf[l]);
+                    }
+                    break;
+                case 0x0029:
+                    //FX29: Sets I to the location of the font sprite for V[X]
+                    for (l = 0; l < LANES; l++) {
+                        I[l] = SELECT(MASK16(m[l]), x[l] * 5, I[l]);
+                    }
+                    break;
+                default:
+                    return false;
+            }
+
+            for (l = 0; l < LANES; l++) {
+                pc[l] += 2 & MASK16(m[l]);
+            }
+            break;
+        default:
+            return false;
+    }
+
+    for (l = 0; l < LANES; l++) {
+        batch->cycles[l] += m[l] & 1;
+    }
+
+    return true;
+}
+
+//true for the opcodes that chip8_batch_vector() or chip8_batch_lanes() run which go on to the
+//next instruction and leave memory alone, so a block carries on past them
+static bool
+chip8_batch_straight(const struct chip8_batch *batch, uint16_t opcode) {
+    switch (opcode & 0xF000) {
+        case 0x6000:
+        case 0x7000:
+        case 0xA000:
+        case 0xC000:
+            return true;
+        case 0x8000:
+            switch (opcode & 0x000F) {
+                case 0x0000:
+                case 0x0004:
+                case 0x0005:
+                case 0x0007:
+                    return true;
+                case 0x0001:
+                case 0x0002:
+                case 0x0003:
+                case 0x0006:
+                case 0x000E:
+                    return batch->default_profile;
+                default:
+                    return false;
+            }
+        case 0xF000:
+            switch (opcode & 0x00FF) {
+                case 0x0007:
+                case 0x0015:
+                case 0x0018:
+                case 0x001E:
+                case 0x0029:
+                case 0x0065:
+                    return true;
+                default:
+                    return false;
+            }
+        default:
+            return false;
+    }
+}
+
+//the block every running lane has at pc, decoded from their memory if it isn't known yet
+//it ends early where the lanes' instructions differ, so it may be empty
+static const struct chip8_batch_block *
+chip8_batch_block(struct chip8_batch *batch, uint16_t pc) {
+    struct chip8_batch_block *block = &batch->blocks[(pc >> 1) % CHIP8_BATCH_BLOCKS];
+    unsigned int l, first;
+    uint16_t addr, opcode;
+
+    if (block->pc == pc && block->generation == batch->generation) {
+        return block;
+    }
+
+    block->pc = pc;
+    block->generation = batch->generation;
+    block->length = 0;
+
+    first = 0;
+    while (!batch->running[first]) {
+        ++first;
+    }
+
+    while (block->length < CHIP8_BATCH_BLOCK_LENGTH) {
+        addr = pc + block->length * 2;
+        opcode = batch->memory[first][addr & batch->wrap[first]] << 8 |
+                 batch->memory[first][(addr + 1) & batch->wrap[first]];
+
+        //halted lanes never run again before chip8_batch_gather() throws the block away,
+        //but lanes waiting for a key do, so they have to agree too
+        for (l = first + 1; l < batch->lanes; l++) {
+            if (batch->running[l] && (batch->memory[l][addr & batch->wrap[l]] << 8 |
+                                      batch->memory[l][(addr + 1) & batch->wrap[l]]) != opcode) {
+                return block;
+            }
+        }
+
+        block->opcodes[block->length++] = opcode;
+
+        if (!chip8_batch_straight(batch, opcode)) {
+            break;
+        }
+    }
+
+    return block;
+}
+
+//runs at most count instructions of the block at pc on every active lane, if they are all there
+//returns the instructions run, 0 if the lanes are apart or the first one has to be grouped
+static unsigned int
+chip8_batch_run_block(struct chip8_batch *batch, unsigned int count) {
+    const struct chip8_batch_block *block;
+    uint8_t mask[LANES];
+    uint16_t pc, apart;
+    unsigned int l, i;
+
+    //the caller made sure at least one lane is active
+    memcpy(mask, batch->active, sizeof(mask));
+    l = 0;
+    while (!mask[l]) {
+        ++l;
+    }
+
+    pc = batch->pc[l];
+
+    apart = 0;
+    for (l = 0; l < LANES; l++) {
+        apart |= (batch->pc[l] ^ pc) & MASK16(mask[l]);
+    }
+
+    if (apart != 0) {
+        return 0;
+    }
+
+    block = chip8_batch_block(batch, pc);
+    for (i = 0; i < block->length && i < count; i++) {
+        if (!chip8_batch_vector(batch, block->opcodes[i], mask) && !chip8_batch_lanes(batch, block->opcodes[i], mask)) {
+            break;
+        }
+    }
+
+    return i;
+}
+
+//advances every active lane by one instruction
+//returns false if most lanes had to take the scalar path, either because they have drifted
+//apart or because the code they are running has no handlers here
+VECTOR_CLONES static bool
+chip8_batch_step(struct chip8_batch *batch) {
+    uint16_t opcodes[LANES];
+    uint8_t pending[LANES], mask[LANES];
+    unsigned int l, leader, size, lanes, groups, scalar;
+    uint16_t wrap;
+    uint16_t opcode;
+
+    //halted and waiting lanes are fetched too, they're left out by pending
+    memset(opcodes, 0, sizeof(opcodes));
+    for (l = 0; l < batch->lanes; l++) {
+        wrap = batch->wrap[l];
+        opcodes[l] = batch->memory[l][batch->pc[l] & wrap] << 8 | batch->memory[l][(batch->pc[l] + 1) & wrap];
+    }
+
+    memcpy(pending, batch->active, sizeof(pending));
+    lanes = 0;
+    for (l = 0; l < LANES; l++) {
+        lanes += pending[l] & 1;
+    }
+
+    //take the opcode of the first lane still pending and run every lane that shares it as
+    //one group, repeating until all lanes have stepped; lanes in lock-step form a single group
+    leader = 0;
+    groups = 0;
+    scalar = 0;
+    while (true) {
+        while (leader < batch->lanes && !pending[leader]) {
+            ++leader;
+        }
+
+        if (leader == batch->lanes) {
+            break;
+        }
+
+        //too many groups already, step whatever is left one lane at a time
+        if (groups * LOCKSTEP_GROUP_MIN > lanes) {
+            for (l = leader; l < batch->lanes; l++) {
+                if (pending[l]) {
+                    chip8_batch_scalar(batch, l);
+                }
+            }
+
+            return false;
+        }
+
+        opcode = opcodes[leader];
+        size = 0;
+        for (l = 0; l < LANES; l++) {
+            mask[l] = pending[l] & -(opcodes[l] == opcode);
+            pending[l] &= ~mask[l];
+            size += mask[l] & 1;
+        }
+
+        ++groups;
+
+        if (!chip8_batch_vector(batch, opcode, mask) && !chip8_batch_lanes(batch, opcode, mask)) {
+            for (l = leader; l < batch->lanes; l++) {
+                if (mask[l]) {
+                    chip8_batch_scalar(batch, l);
+                }
+            }
+
+            scalar += size;
+        }
+    }
+
+    return scalar * 2 <= lanes;
+}
+
+//runs every lane on its own for count instructions, used once the lanes have diverged
+//since lanes never interact this gives the same result as stepping them in lock-step
+//the registers stay in the machines until lock-step is tried again, so a diverged batch costs
+//about what the same machines would on their own
+static void
+chip8_batch_run_lanes(struct chip8_batch *batch, unsigned int count) {
+    unsigned int l, events;
+
+    if (!batch->scattered) {
+        chip8_batch_scatter(batch);
+        batch->scattered = true;
+    }
+
+    //nothing is known about what the lanes write to memory on their own
+    ++batch->generation;
+
+    for (l = 0; l < batch->lanes; l++) {
+        if (!batch->active[l]) {
+            continue;
+        }
+
+        events = chip8_run_cycles(batch->machines[l], count);
+        if (events & (CHIP8_EVENT_UNHANDLED | CHIP8_EVENT_EXIT)) {
+            batch->running[l] = 0x00;
+        }
+
+        batch->events[l] |= events;
+    }
+}
+
+//runs count instructions on every running lane and returns the events raised by any lane
+//per-lane events are left in batch->events, lanes that hit an unhandled opcode stop running
+//and, as with chip8_run_cycles(), a lane that starts waiting for a key stops until the next call
+//once the lanes diverge the rest of the batch runs each lane on its own
+unsigned int
+chip8_batch_run_cycles(struct chip8_batch *batch, unsigned int count) {
+    unsigned int events = 0;
+    unsigned int l, ran;
+    bool active;
+
+    memset(batch->events, 0, sizeof(batch->events));
+    memcpy(batch->active, batch->running, sizeof(batch->active));
+
+    while (count > 0) {
+        active = false;
+        for (l = 0; l < batch->lanes && !active; l++) {
+            active = batch->active[l] != 0;
+        }
+
+        if (!active) {
+            break;
+        }
+
+        //lanes can converge again later (e.g. all waiting on the same timer), so lock-step is retried
+        //every so often rather than given up on for good
+        if (batch->backoff > 0) {
+            --batch->backoff;
+            chip8_batch_run_lanes(batch, count);
+            break;
+        }
+
+        if (batch->scattered) {
+            for (l = 0; l < batch->lanes; l++) {
+                chip8_batch_gather_lane(batch, l);
+            }
+
+            batch->scattered = false;
+        }
+
+        //lanes that all sit at the same address run the block there without fetching or grouping
+        ran = chip8_batch_run_block(batch, count);
+        if (ran > 0) {
+            count -= ran;
+            batch->backoff_next = DIVERGED_BACKOFF;
+            continue;
+        }
+
+        --count;
+        if (!chip8_batch_step(batch)) {
+            batch->backoff = batch->backoff_next;
+            if (batch->backoff_next < DIVERGED_BACKOFF_MAX) {
+                batch->backoff_next *= 2;
+            }
+
+            chip8_batch_run_lanes(batch, count);
+            break;
+        }
+
+        batch->backoff_next = DIVERGED_BACKOFF;
+    }
+
+    for (l = 0; l < batch->lanes; l++) {
+        events |= batch->events[l];
+    }
+
+    return events;
+}
+
+//counts every lane's delay timer and sound timer down once, should be called at 60Hz
+unsigned int
+chip8_batch_tick_timers(struct chip8_batch *batch) {
+    unsigned int events = 0, lane_events;
+    unsigned int l;
+
+    if (batch->scattered) {
+        for (l = 0; l < batch->lanes; l++) {
+            lane_events = chip8_tick_timers(batch->machines[l]);
+            batch->events[l] |= lane_events;
+            events |= lane_events;
+        }
+
+        return events;
+    }
+
+    for (l = 0; l < LANES; l++) {
+        if (batch->st[l] == 1) {
+            batch->events[l] |= CHIP8_EVENT_SOUND_OFF;
+            events |= CHIP8_EVENT_SOUND_OFF;
+        }
+    }
+
+    for (l = 0; l < LANES; l++) {
+        batch->dt[l] -= batch->dt[l] > 0;
+        batch->st[l] -= batch->st[l] > 0;
+    }
+
+    return events;
+}
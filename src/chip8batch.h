@@ -0,0 +1,104 @@
+#ifndef CHIP8BATCH_H
+#define CHIP8BATCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "chip8.h"
+
+//the most machines a batch can run in lock-step, one AVX2 register of bytes
+#define CHIP8_BATCH_LANES 32
+
+//the most instructions decoded into one block, and how many blocks are kept
+#define CHIP8_BATCH_BLOCK_LENGTH 16
+#define CHIP8_BATCH_BLOCKS       64
+
+//instructions that every running lane has at pc, decoded once and then run with all lanes
+//in lock-step without fetching or grouping, up to and including the first that doesn't just
+//fall through to the next instruction
+//only valid while generation matches the batch's, as lanes' memory may change
+struct chip8_batch_block {
+    uint16_t pc;
+    uint16_t length;
+    uint32_t generation;
+    uint16_t opcodes[CHIP8_BATCH_BLOCK_LENGTH];
+};
+
+//runs many machines in lock-step
+//while every lane sits at the same address the block there is decoded once and
+//run one vector operation per instruction, lanes that drift apart are grouped by
+//opcode each instruction instead, calls, returns, key skips and memory ops go
+//through each lane's machine without copying its registers, and draws and any
+//other opcode fall back to chip8_cycle() for that lane, so only those are traced
+//this only beats separate machines while the lanes stay together, such as lanes
+//given the same seed and keys; once they drift apart each lane runs on its own,
+//which costs a little more than separate machines would
+struct chip8_batch {
+    //registers are stored structure-of-arrays, the lane index is the fastest moving
+    uint8_t V[16][CHIP8_BATCH_LANES];
+    uint16_t I[CHIP8_BATCH_LANES];
+    uint16_t pc[CHIP8_BATCH_LANES];
+    uint8_t dt[CHIP8_BATCH_LANES];
+    uint8_t st[CHIP8_BATCH_LANES];
+    uint32_t rng[CHIP8_BATCH_LANES];
+    uint64_t cycles[CHIP8_BATCH_LANES];
+
+    //0xFF for lanes that are running, 0x00 for unused or halted lanes
+    uint8_t running[CHIP8_BATCH_LANES];
+
+    //running lanes that haven't started waiting for a key during the current chip8_batch_run_cycles()
+    uint8_t active[CHIP8_BATCH_LANES];
+
+    //true if every lane runs the default quirk profile, which the vector handlers implement
+    bool default_profile;
+
+    //true if any lane runs XO-CHIP, where a skip may step over a 4 byte instruction and 5XY2/5XY3 exist
+    bool long_skips;
+
+    //0xFF for lanes whose profile sets VF when FX1E overflows, 0x00 for the rest
+    uint8_t add_i_vf[CHIP8_BATCH_LANES];
+
+    //0xFF for lanes whose profile moves I past the registers FX55 and FX65 copy, 0x00 for the rest
+    uint8_t load_store_inc_i[CHIP8_BATCH_LANES];
+
+    //upcoming chip8_batch_run_cycles() calls that run each lane on its own because the lanes diverged,
+    //and how many the next divergence skips, which grows while the lanes stay apart
+    unsigned int backoff;
+    unsigned int backoff_next;
+
+    //true while the lanes run on their own, each lane's machine then holds its registers
+    //and the arrays above are only filled in again when lock-step is retried
+    bool scattered;
+
+    //events raised by each lane during the last chip8_batch_run_cycles()
+    unsigned int events[CHIP8_BATCH_LANES];
+
+    //memory, stack, framebuffer and keys stay in each lane's machine since they
+    //are indexed by per-lane values and can't be loaded as a vector anyway
+    struct chip8 *machines[CHIP8_BATCH_LANES];
+
+    //each lane's memory and its size minus one, so fetching doesn't have to go through the machine
+    const unsigned char *memory[CHIP8_BATCH_LANES];
+    uint16_t wrap[CHIP8_BATCH_LANES];
+    unsigned int lanes;
+
+    //bumped whenever a lane may have written to its memory, which throws away every decoded block
+    uint32_t generation;
+    struct chip8_batch_block blocks[CHIP8_BATCH_BLOCKS];
+};
+
+struct chip8_batch *chip8_batch_create(unsigned int lanes);
+void chip8_batch_destroy(struct chip8_batch *batch);
+
+struct chip8 *chip8_batch_lane(struct chip8_batch *batch, unsigned int lane);
+
+bool chip8_batch_load_mem(struct chip8_batch *batch, const unsigned char *rom, size_t size);
+void chip8_batch_reset(struct chip8_batch *batch);
+
+void chip8_batch_gather(struct chip8_batch *batch);
+void chip8_batch_scatter(struct chip8_batch *batch);
+
+unsigned int chip8_batch_run_cycles(struct chip8_batch *batch, unsigned int count);
+unsigned int chip8_batch_tick_timers(struct chip8_batch *batch);
+
+#endif
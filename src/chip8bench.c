@@ -0,0 +1,350 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include "chip8.h"
+#include "chip8batch.h"
+
+//each measurement is the best of this many runs
+#define BENCH_RUNS 3
+
+static unsigned int opt_frames = 6000;
+static unsigned int opt_cycles = 20;
+static enum chip8_profile opt_profile = CHIP8_PROFILE_DEFAULT;
+static unsigned int opt_lanes = CHIP8_BATCH_LANES;
+
+static uint64_t
+time_ns() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//hold a different key down for half a second, then let go for half a second
+static void
+press_keys(struct chip8 *chip8, unsigned int frame) {
+    memset(chip8->key, 0, sizeof(chip8->key));
+    if ((frame / 30) % 2 == 0) {
+        chip8->key[(frame / 60) % 16] = 1;
+    }
+}
+
+//runs the ROM headless with a fixed seed and a scripted key pattern
+//returns the nanoseconds taken and leaves the final state in chip8
+static uint64_t
+run(struct chip8 *chip8, enum chip8_dispatch dispatch) {
+    uint64_t start;
+    unsigned int frame;
+
+    chip8_set_dispatch(chip8, dispatch);
+    chip8_seed(chip8, 1);
+    chip8_reset(chip8);
+
+    start = time_ns();
+    for (frame = 0; frame < opt_frames; frame++) {
+        press_keys(chip8, frame);
+
+        if (chip8_run_cycles(chip8, opt_cycles) & CHIP8_EVENT_UNHANDLED) {
+            break;
+        }
+
+        chip8_tick_timers(chip8);
+    }
+
+    return time_ns() - start;
+}
+
+static bool
+same_state(const struct chip8 *a, const struct chip8 *b) {
+    return a->pc == b->pc && a->I == b->I && a->sp == b->sp && a->cycles == b->cycles &&
+           memcmp(a->V, b->V, sizeof(a->V)) == 0 &&
+           memcmp(a->memory, b->memory, sizeof(a->memory)) == 0 &&
+           memcmp(a->gfx, b->gfx, sizeof(a->gfx)) == 0;
+}
+
+//runs opt_lanes machines one after another every frame, the way a program without the batch would
+//every machine gets the lane's seed and the same keys as in run_batch()
+//returns the nanoseconds taken and adds the instructions executed to cycles
+static uint64_t
+run_scalar(struct chip8 **machines, uint64_t *cycles) {
+    uint64_t start, ns;
+    unsigned int frame, l;
+
+    for (l = 0; l < opt_lanes; l++) {
+        chip8_seed(machines[l], l + 1);
+        chip8_reset(machines[l]);
+    }
+
+    start = time_ns();
+    for (frame = 0; frame < opt_frames; frame++) {
+        for (l = 0; l < opt_lanes; l++) {
+            press_keys(machines[l], frame);
+            chip8_run_cycles(machines[l], opt_cycles);
+            chip8_tick_timers(machines[l]);
+        }
+    }
+    ns = time_ns() - start;
+
+    for (l = 0; l < opt_lanes; l++) {
+        *cycles += machines[l]->cycles;
+    }
+
+    return ns;
+}
+
+//runs the same opt_lanes machines as run_scalar() as the lanes of one lock-step batch
+static uint64_t
+run_batch(struct chip8_batch *batch, uint64_t *cycles) {
+    uint64_t start, ns;
+    unsigned int frame, l;
+
+    for (l = 0; l < opt_lanes; l++) {
+        chip8_seed(chip8_batch_lane(batch, l), l + 1);
+    }
+    chip8_batch_reset(batch);
+
+    start = time_ns();
+    for (frame = 0; frame < opt_frames; frame++) {
+        for (l = 0; l < opt_lanes; l++) {
+            press_keys(chip8_batch_lane(batch, l), frame);
+        }
+
+        chip8_batch_run_cycles(batch, opt_cycles);
+        chip8_batch_tick_timers(batch);
+    }
+    ns = time_ns() - start;
+
+    chip8_batch_scatter(batch);
+    for (l = 0; l < opt_lanes; l++) {
+        *cycles += chip8_batch_lane(batch, l)->cycles;
+    }
+
+    return ns;
+}
+
+//compares a lock-step batch of opt_lanes machines against as many scalar machines on every ROM
+//every lane has its own seed, so ROMs that use CXNN soon drift apart and show the batch's worst case
+static bool
+bench_batch(char **roms, int count, enum chip8_dispatch dispatch) {
+    struct chip8 *machines[CHIP8_BATCH_LANES];
+    struct chip8_batch *batch;
+    uint64_t best_scalar, best_batch, scalar_cycles, batch_cycles, ns;
+    double scalar_mips, batch_mips;
+    unsigned int l;
+    int i, run_no;
+    bool success = true;
+
+    //everything is created before anything is checked, so a failure can free it all in one place
+    batch = chip8_batch_create(opt_lanes);
+    for (l = 0; l < opt_lanes; l++) {
+        machines[l] = chip8_create();
+        success = success && machines[l] != NULL;
+    }
+
+    if (batch == NULL || !success) {
+        for (l = 0; l < opt_lanes; l++) {
+            chip8_destroy(machines[l]);
+        }
+        chip8_batch_destroy(batch);
+
+        return false;
+    }
+
+    for (l = 0; l < opt_lanes; l++) {
+        chip8_set_profile(machines[l], opt_profile);
+        chip8_set_dispatch(machines[l], dispatch);
+        chip8_set_profile(chip8_batch_lane(batch, l), opt_profile);
+        chip8_set_dispatch(chip8_batch_lane(batch, l), dispatch);
+    }
+
+    printf("\n%-24s%12s%12s%12s   (%u machines, %s dispatch, million instructions per second)\n",
+           "ROM", "scalar", "batch", "speedup", opt_lanes, chip8_dispatch_name(dispatch));
+
+    for (i = 0; i < count; i++) {
+        for (l = 0; l < opt_lanes; l++) {
+            if (!chip8_load(machines[l], roms[i]) || !chip8_load(chip8_batch_lane(batch, l), roms[i])) {
+                break;
+            }
+        }
+
+        if (l < opt_lanes) {
+            printf("%s: could not load\n", roms[i]);
+            success = false;
+            continue;
+        }
+
+        best_scalar = UINT64_MAX;
+        best_batch = UINT64_MAX;
+        for (run_no = 0; run_no < BENCH_RUNS; run_no++) {
+            scalar_cycles = 0;
+            ns = run_scalar(machines, &scalar_cycles);
+            if (ns < best_scalar) {
+                best_scalar = ns;
+            }
+
+            batch_cycles = 0;
+            ns = run_batch(batch, &batch_cycles);
+            if (ns < best_batch) {
+                best_batch = ns;
+            }
+        }
+
+        //both ran the same machines with the same keys, so every lane has to end up where its twin did
+        for (l = 0; l < opt_lanes; l++) {
+            if (!same_state(chip8_batch_lane(batch, l), machines[l])) {
+                printf("%s: batch lane %u diverged from its scalar machine\n", roms[i], l);
+                success = false;
+                break;
+            }
+        }
+
+        scalar_mips = best_scalar > 0 ? scalar_cycles * 1000.0 / best_scalar : 0;
+        batch_mips = best_batch > 0 ? batch_cycles * 1000.0 / best_batch : 0;
+        printf("%-24.24s%12.1f%12.1f%11.2fx\n", roms[i], scalar_mips, batch_mips,
+               scalar_mips > 0 ? batch_mips / scalar_mips : 0);
+    }
+
+    for (l = 0; l < opt_lanes; l++) {
+        chip8_destroy(machines[l]);
+    }
+    chip8_batch_destroy(batch);
+
+    return success;
+}
+
+static void
+usage(const char *fmt, ...) {
+    va_list ap;
+
+    if (fmt != NULL) {
+        va_start(ap, fmt);
+        vprintf(fmt, ap);
+        va_end(ap);
+
+        fputc('\n', stdout);
+    }
+
+    puts("Usage: chip8bench [options] <rom path>...");
+    puts("Runs every ROM headless with each dispatch strategy and reports the fastest,");
+    puts("then runs it as the lanes of a lock-step batch and as separate machines.");
+    puts("Options:");
+    puts(" -n <frames> Number of 60Hz frames to run each ROM for. The default is 6000.");
+    puts(" -c <count>  Instructions per frame. The default is 20.");
+    puts(" -q <quirks> Quirk profile to benchmark. The default is default.");
+    puts(" -l <lanes>  Machines in the lock-step batch compared against as many scalar machines");
+    printf("             run with the fastest dispatch. The default is %d, 0 skips the comparison.\n", CHIP8_BATCH_LANES);
+}
+
+int
+main(int argc, char **argv) {
+    struct chip8 *chip8, *reference;
+    uint64_t best[CHIP8_DISPATCH_COUNT], total[CHIP8_DISPATCH_COUNT], ns;
+    double mips;
+    int i, d, run_no, fastest, first;
+    bool success = true;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            opt_frames = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            opt_cycles = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-q") == 0 && i + 1 < argc) {
+            if (!chip8_profile_find(argv[++i], &opt_profile)) {
+                usage("Invalid quirk profile");
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+            opt_lanes = atoi(argv[++i]);
+            if (opt_lanes > CHIP8_BATCH_LANES) {
+                usage("A batch has at most %d lanes", CHIP8_BATCH_LANES);
+                return 1;
+            }
+        }
+        else {
+            break;
+        }
+    }
+
+    if (i == argc) {
+        usage("No ROM path given");
+        return 1;
+    }
+
+    chip8 = chip8_create();
+    reference = chip8_create();
+    if (chip8 == NULL || reference == NULL) {
+        chip8_destroy(chip8);
+        chip8_destroy(reference);
+        return 1;
+    }
+
+    chip8_set_profile(chip8, opt_profile);
+    chip8_set_profile(reference, opt_profile);
+    memset(total, 0, sizeof(total));
+
+    printf("%-24s", "ROM");
+    for (d = 0; d < CHIP8_DISPATCH_COUNT; d++) {
+        printf("%12s", chip8_dispatch_name(d));
+    }
+    printf("   (million instructions per second)\n");
+
+    for (first = i; i < argc; i++) {
+        if (!chip8_load(chip8, argv[i]) || !chip8_load(reference, argv[i])) {
+            printf("%s: could not load\n", argv[i]);
+            success = false;
+            continue;
+        }
+
+        run(reference, CHIP8_DISPATCH_SWITCH);
+
+        for (d = 0; d < CHIP8_DISPATCH_COUNT; d++) {
+            best[d] = UINT64_MAX;
+            for (run_no = 0; run_no < BENCH_RUNS; run_no++) {
+                ns = run(chip8, d);
+                if (ns < best[d]) {
+                    best[d] = ns;
+                }
+            }
+
+            total[d] += best[d];
+
+            if (!same_state(chip8, reference)) {
+                printf("%s: %s dispatch diverged from switch\n", argv[i], chip8_dispatch_name(d));
+                success = false;
+            }
+        }
+
+        printf("%-24.24s", argv[i]);
+        for (d = 0; d < CHIP8_DISPATCH_COUNT; d++) {
+            mips = best[d] > 0 ? reference->cycles * 1000.0 / best[d] : 0;
+            printf("%12.1f", mips);
+        }
+        printf("\n");
+    }
+
+    fastest = 0;
+    for (d = 1; d < CHIP8_DISPATCH_COUNT; d++) {
+        if (total[d] < total[fastest]) {
+            fastest = d;
+        }
+    }
+
+    printf("Fastest on this host: %s\n", chip8_dispatch_name(fastest));
+
+    if (opt_lanes > 0 && !bench_batch(argv + first, argc - first, fastest)) {
+        success = false;
+    }
+
+    chip8_destroy(chip8);
+    chip8_destroy(reference);
+
+    return success ? 0 : 1;
+}
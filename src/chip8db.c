@@ -0,0 +1,399 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "chip8db.h"
+
+#define DB_MAGIC   "CHIP8DB"
+#define DB_VERSION 2
+
+struct chip8_db_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+};
+
+struct chip8_db {
+    char *path;
+
+    //the whole file mapped read-only, NULL while the database is empty
+    void *map;
+    size_t map_size;
+
+    const struct chip8_db_entry *entries;
+    unsigned int count;
+};
+
+//64 bit FNV-1a style mixing a word at a time rather than a byte at a time
+uint64_t
+chip8_rom_hash(const unsigned char *rom, size_t size) {
+    uint64_t h = 0xCBF29CE484222325ULL ^ size, w;
+    size_t i;
+
+    for (i = 0; i + sizeof(w) <= size; i += sizeof(w)) {
+        memcpy(&w, rom + i, sizeof(w));
+        h = (h ^ w) * 0x100000001B3ULL;
+        h ^= h >> 29;
+    }
+
+    for (; i < size; i++) {
+        h = (h ^ rom[i]) * 0x100000001B3ULL;
+    }
+
+    return h ^ (h >> 32);
+}
+
+struct chip8_walk {
+    //one bit and at most one queued entry per address
+    unsigned char visited[CHIP8_MEMORY_MAX / 8];
+    uint16_t work[CHIP8_MEMORY_MAX];
+    uint32_t pending;
+};
+
+static void
+chip8_walk_queue(struct chip8_walk *walk, uint16_t addr) {
+    if ((walk->visited[addr / 8] & (1 << (addr % 8))) == 0) {
+        walk->visited[addr / 8] |= 1 << (addr % 8);
+        walk->work[walk->pending++] = addr;
+    }
+}
+
+//where a skip at addr lands, past the 4 byte F000 NNNN if that's what's being skipped
+static uint16_t
+chip8_walk_skip(const unsigned char *rom, uint32_t end, uint16_t addr) {
+    uint32_t next = addr + 2;
+
+    if (next + 1 < end && rom[next - CHIP8_PROGRAM_START] == 0xF0 && rom[next - CHIP8_PROGRAM_START + 1] == 0x00) {
+        return next + 4;
+    }
+
+    return next + 2;
+}
+
+//walks the code reachable from the entry point, following both sides of every skip and branch
+//the walk stops at anything it can't follow: returns, computed jumps and unknown opcodes
+void
+chip8_rom_analyze(const unsigned char *rom, size_t size, struct chip8_rom_analysis *analysis) {
+    struct chip8_walk *walk;
+    uint16_t opcode, addr, next;
+    uint32_t end = CHIP8_PROGRAM_START + size;
+    uint16_t uses = 0;
+
+    memset(analysis, 0, sizeof(*analysis));
+    analysis->profile = CHIP8_PROFILE_DEFAULT;
+
+    walk = calloc(1, sizeof(*walk));
+    if (walk == NULL) {
+        return;
+    }
+
+    chip8_walk_queue(walk, CHIP8_PROGRAM_START);
+
+    while (walk->pending > 0) {
+        addr = walk->work[--walk->pending];
+        if (addr < CHIP8_PROGRAM_START || addr + 1u >= end) {
+            continue;
+        }
+
+        opcode = rom[addr - CHIP8_PROGRAM_START] << 8 | rom[addr - CHIP8_PROGRAM_START + 1];
+        next = addr + 2;
+        ++analysis->reachable;
+
+        switch (opcode & 0xF000) {
+            case 0x0000:
+                if ((opcode & 0x00FF) == 0x00E0) {
+                    chip8_walk_queue(walk, next);
+                }
+                else if ((opcode & 0x00FF) == 0x00FD) {
+                    uses |= CHIP8_ROM_USES_SCHIP;
+                }
+                else if ((opcode & 0x00FF) >= 0x00FB || (opcode & 0x00F0) == 0x00C0) {
+                    uses |= CHIP8_ROM_USES_SCHIP;
+                    chip8_walk_queue(walk, next);
+                }
+                else if ((opcode & 0x00F0) == 0x00D0) {
+                    uses |= CHIP8_ROM_USES_XOCHIP;
+                    chip8_walk_queue(walk, next);
+                }
+                break;
+            case 0x1000:
+                chip8_walk_queue(walk, opcode & 0x0FFF);
+                break;
+            case 0x2000:
+                chip8_walk_queue(walk, opcode & 0x0FFF);
+                chip8_walk_queue(walk, next);
+                break;
+            case 0x5000:
+                if ((opcode & 0x000F) == 0x0002 || (opcode & 0x000F) == 0x0003) {
+                    uses |= CHIP8_ROM_USES_XOCHIP;
+                    chip8_walk_queue(walk, next);
+                    break;
+                }
+                //fall through
+            case 0x3000:
+            case 0x4000:
+            case 0x9000:
+                chip8_walk_queue(walk, next);
+                chip8_walk_queue(walk, chip8_walk_skip(rom, end, addr));
+                break;
+            case 0x8000:
+                if ((opcode & 0x000F) <= 0x0007 || (opcode & 0x000F) == 0x000E) {
+                    chip8_walk_queue(walk, next);
+                }
+                break;
+            case 0xB000:
+                uses |= CHIP8_ROM_USES_BXNN;
+                break;
+            case 0xD000:
+                if ((opcode & 0x000F) == 0) {
+                    uses |= CHIP8_ROM_USES_SCHIP;
+                }
+                chip8_walk_queue(walk, next);
+                break;
+            case 0xE000:
+                if ((opcode & 0x00FF) == 0x009E || (opcode & 0x00FF) == 0x00A1) {
+                    uses |= CHIP8_ROM_USES_KEYS;
+                    chip8_walk_queue(walk, next);
+                    chip8_walk_queue(walk, chip8_walk_skip(rom, end, addr));
+                }
+                break;
+            case 0xF000:
+                if (opcode == 0xF000) {
+                    uses |= CHIP8_ROM_USES_XOCHIP;
+                    chip8_walk_queue(walk, next + 2);
+                    break;
+                }
+
+                switch (opcode & 0x00FF) {
+                    case 0x01:
+                    case 0x02:
+                    case 0x3A:
+                        uses |= CHIP8_ROM_USES_XOCHIP;
+                        chip8_walk_queue(walk, next);
+                        break;
+                    case 0x30:
+                    case 0x75:
+                    case 0x85:
+                        uses |= CHIP8_ROM_USES_SCHIP;
+                        chip8_walk_queue(walk, next);
+                        break;
+                    case 0x0A:
+                        uses |= CHIP8_ROM_USES_KEYS;
+                        chip8_walk_queue(walk, next);
+                        break;
+                    case 0x18:
+                        uses |= CHIP8_ROM_USES_SOUND;
+                        chip8_walk_queue(walk, next);
+                        break;
+                    case 0x07:
+                    case 0x15:
+                    case 0x1E:
+                    case 0x29:
+                    case 0x33:
+                    case 0x55:
+                    case 0x65:
+                        chip8_walk_queue(walk, next);
+                        break;
+                }
+                break;
+            default:
+                //6XNN, 7XNN, ANNN and CXNN
+                chip8_walk_queue(walk, next);
+                break;
+        }
+    }
+
+    analysis->uses = uses;
+    if (uses & CHIP8_ROM_USES_XOCHIP) {
+        analysis->profile = CHIP8_PROFILE_XOCHIP;
+    }
+    else if (uses & CHIP8_ROM_USES_SCHIP) {
+        analysis->profile = CHIP8_PROFILE_SCHIP;
+    }
+
+    free(walk);
+}
+
+//maps the file at db->path, a missing file is an empty database
+static bool
+chip8_db_map(struct chip8_db *db) {
+    const struct chip8_db_header *header;
+    struct stat st;
+    int fd;
+
+    db->map = NULL;
+    db->map_size = 0;
+    db->entries = NULL;
+    db->count = 0;
+
+    fd = open(db->path, O_RDONLY);
+    if (fd < 0) {
+        return errno == ENOENT;
+    }
+
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(*header)) {
+        close(fd);
+        return false;
+    }
+
+    db->map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (db->map == MAP_FAILED) {
+        db->map = NULL;
+        return false;
+    }
+
+    db->map_size = st.st_size;
+
+    //refuse anything that isn't ours rather than overwrite it later
+    header = db->map;
+    if (memcmp(header->magic, DB_MAGIC, sizeof(header->magic)) != 0 || header->version > DB_VERSION ||
+        (header->version == DB_VERSION &&
+         sizeof(*header) + (size_t)header->count * sizeof(struct chip8_db_entry) > db->map_size)) {
+        munmap(db->map, db->map_size);
+        db->map = NULL;
+        return false;
+    }
+
+    //an older layout of ours starts over empty and is replaced by the next chip8_db_put()
+    if (header->version < DB_VERSION) {
+        munmap(db->map, db->map_size);
+        db->map = NULL;
+        db->map_size = 0;
+        return true;
+    }
+
+    db->entries = (const struct chip8_db_entry *)(header + 1);
+    db->count = header->count;
+
+    return true;
+}
+
+static void
+chip8_db_unmap(struct chip8_db *db) {
+    if (db->map != NULL) {
+        munmap(db->map, db->map_size);
+        db->map = NULL;
+    }
+}
+
+struct chip8_db *
+chip8_db_open(const char *path) {
+    struct chip8_db *db;
+
+    db = calloc(1, sizeof(*db));
+    if (db == NULL) {
+        return NULL;
+    }
+
+    db->path = strdup(path);
+    if (db->path == NULL || !chip8_db_map(db)) {
+        chip8_db_close(db);
+        return NULL;
+    }
+
+    return db;
+}
+
+void
+chip8_db_close(struct chip8_db *db) {
+    if (db == NULL) {
+        return;
+    }
+
+    chip8_db_unmap(db);
+    free(db->path);
+    free(db);
+}
+
+unsigned int
+chip8_db_count(const struct chip8_db *db) {
+    return db->count;
+}
+
+//the index of the first entry that doesn't sort before (hash, rom_size), entries are ordered by hash then size
+static unsigned int
+chip8_db_lower_bound(const struct chip8_db *db, uint64_t hash, uint32_t rom_size) {
+    const struct chip8_db_entry *entry;
+    unsigned int lo = 0, hi = db->count, mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        entry = &db->entries[mid];
+        if (entry->hash < hash || (entry->hash == hash && entry->rom_size < rom_size)) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+//the entry for the ROM with this hash and size, or NULL, valid until the next chip8_db_put()
+//the size is checked as well so a hash collision between ROMs of different sizes isn't taken as a match
+const struct chip8_db_entry *
+chip8_db_find(const struct chip8_db *db, uint64_t hash, uint32_t rom_size) {
+    unsigned int i = chip8_db_lower_bound(db, hash, rom_size);
+
+    return i < db->count && db->entries[i].hash == hash && db->entries[i].rom_size == rom_size ? &db->entries[i] : NULL;
+}
+
+//adds entry or replaces the one with the same hash and size, rewriting the file next to the old one and renaming it into place
+//so a reader never sees half a database
+bool
+chip8_db_put(struct chip8_db *db, const struct chip8_db_entry *entry) {
+    struct chip8_db_header header;
+    unsigned int i = chip8_db_lower_bound(db, entry->hash, entry->rom_size);
+    bool replace = i < db->count && db->entries[i].hash == entry->hash && db->entries[i].rom_size == entry->rom_size;
+    char *tmp;
+    FILE *f;
+    bool success;
+
+    tmp = malloc(strlen(db->path) + 5);
+    if (tmp == NULL) {
+        return false;
+    }
+    sprintf(tmp, "%s.tmp", db->path);
+
+    f = fopen(tmp, "wb");
+    if (f == NULL) {
+        free(tmp);
+        return false;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, DB_MAGIC, sizeof(header.magic));
+    header.version = DB_VERSION;
+    header.count = db->count + !replace;
+
+    success = fwrite(&header, sizeof(header), 1, f) == 1 &&
+              fwrite(db->entries, sizeof(*entry), i, f) == i &&
+              fwrite(entry, sizeof(*entry), 1, f) == 1 &&
+              fwrite(db->entries + i + replace, sizeof(*entry), db->count - i - replace, f) == db->count - i - replace;
+
+    if (fclose(f) != 0) {
+        success = false;
+    }
+
+    if (success) {
+        success = rename(tmp, db->path) == 0;
+    }
+
+    if (!success) {
+        unlink(tmp);
+    }
+
+    free(tmp);
+
+    //pick up the new file, or the old one again if writing failed
+    chip8_db_unmap(db);
+    return chip8_db_map(db) && success;
+}
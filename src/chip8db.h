@@ -0,0 +1,63 @@
+#ifndef CHIP8DB_H
+#define CHIP8DB_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "chip8.h"
+
+//what chip8_rom_analyze() saw in the code reachable from the entry point
+#define CHIP8_ROM_USES_KEYS   0x01 //EX9E, EXA1 or FX0A
+#define CHIP8_ROM_USES_SOUND  0x02 //FX18
+#define CHIP8_ROM_USES_SCHIP  0x04 //any SUPER-CHIP only opcode
+#define CHIP8_ROM_USES_XOCHIP 0x08 //any XO-CHIP only opcode
+#define CHIP8_ROM_USES_BXNN   0x10 //computed jumps, which can hide code from the analysis
+
+struct chip8_rom_analysis {
+    //instructions found by following every jump, call and skip from the entry point
+    uint32_t reachable;
+
+    //CHIP8_ROM_USES_* flags
+    uint16_t uses;
+
+    //the profile the opcodes point to, an enum chip8_profile
+    uint8_t profile;
+    uint8_t reserved;
+};
+
+//one ROM's settings, stored as is in the database file so it can be used straight from the mapping
+struct chip8_db_entry {
+    uint64_t hash;
+    uint32_t rom_size;
+
+    //best instructions per second, the front end's -f, 0 if nobody has tuned it yet
+    uint32_t speed;
+
+    //an enum chip8_profile
+    uint8_t profile;
+
+    //true once the settings were saved by hand rather than guessed from the analysis
+    uint8_t tuned;
+
+    //the keyboard character for each keypad key 0-F, 0 leaves the front end's default
+    unsigned char key_map[16];
+
+    struct chip8_rom_analysis analysis;
+};
+
+//a ROM index keyed by content hash
+//the file is a small header followed by entries sorted by hash and then size, it's mapped read-only
+//and searched in place, so looking a ROM up costs no parsing however big the library gets
+struct chip8_db;
+
+uint64_t chip8_rom_hash(const unsigned char *rom, size_t size);
+void chip8_rom_analyze(const unsigned char *rom, size_t size, struct chip8_rom_analysis *analysis);
+
+struct chip8_db *chip8_db_open(const char *path);
+void chip8_db_close(struct chip8_db *db);
+
+unsigned int chip8_db_count(const struct chip8_db *db);
+const struct chip8_db_entry *chip8_db_find(const struct chip8_db *db, uint64_t hash, uint32_t rom_size);
+bool chip8_db_put(struct chip8_db *db, const struct chip8_db_entry *entry);
+
+#endif
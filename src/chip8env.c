@@ -0,0 +1,394 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include "chip8env.h"
+
+enum chip8_env_job {
+    CHIP8_ENV_JOB_RESET,
+    CHIP8_ENV_JOB_STEP
+};
+
+//a worker thread and the slice of environments it owns
+struct chip8_env_worker {
+    struct chip8_env *env;
+    pthread_t thread;
+    unsigned int begin;
+    unsigned int end;
+};
+
+struct chip8_env {
+    struct chip8_env_config config;
+    unsigned int count;
+    struct chip8 **machines;
+
+    //reward value read at the end of the previous step
+    uint32_t *scores;
+
+    //written in place every step, one slot per environment
+    uint8_t *obs;
+    size_t obs_size;
+    bool hires;
+    float *rewards;
+    uint8_t *dones;
+
+    //the job the pool is working on, the calling thread always takes the first shard
+    enum chip8_env_job job;
+    const uint16_t *actions;
+    unsigned int frameskip;
+    unsigned int first_end;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond_start;
+    pthread_cond_t cond_done;
+    uint64_t generation;
+    unsigned int pending;
+    bool quit;
+
+    unsigned int workers_count;
+    struct chip8_env_worker *workers;
+};
+
+static uint32_t
+chip8_env_score(const struct chip8_env *env, const struct chip8 *chip8) {
+    uint32_t score = 0;
+    unsigned int i;
+
+    for (i = 0; i < env->config.reward_size; i++) {
+        score = (score << 8) | chip8->memory[(env->config.reward_addr + i) & (chip8->memory_size - 1)];
+    }
+
+    return score;
+}
+
+//spreads the 8 bits of b out to 16, every bit doubled
+static inline uint16_t
+chip8_env_widen(uint8_t b) {
+    uint16_t x = b;
+
+    x = (x | x << 4) & 0x0F0F;
+    x = (x | x << 2) & 0x3333;
+    x = (x | x << 1) & 0x5555;
+
+    return x | x << 1;
+}
+
+//packs the planes OR'd together, the framebuffer rows are already one bit per pixel
+//so each word only needs writing out high byte first
+static void
+chip8_env_pack(const struct chip8_env *env, const struct chip8 *chip8, uint8_t *obs) {
+    unsigned int y, w, b, rows = env->hires ? CHIP8_GFX_MAX_HEIGHT : CHIP8_GFX_HEIGHT;
+    unsigned int words = env->hires ? CHIP8_GFX_WORDS : 1;
+    bool doubled = env->hires && chip8->gfx_width != CHIP8_GFX_MAX_WIDTH;
+    uint64_t word;
+    uint16_t wide;
+
+    for (y = 0; y < rows; y++) {
+        if (doubled) {
+            //each low resolution pixel becomes a 2x2 block
+            word = chip8->gfx[0][y / 2][0] | chip8->gfx[1][y / 2][0];
+            for (b = 0; b < 8; b++) {
+                wide = chip8_env_widen(word >> (56 - 8 * b));
+                *obs++ = wide >> 8;
+                *obs++ = wide;
+            }
+        }
+        else {
+            for (w = 0; w < words; w++) {
+                word = chip8->gfx[0][y][w] | chip8->gfx[1][y][w];
+                for (b = 0; b < 8; b++) {
+                    *obs++ = word >> (56 - 8 * b);
+                }
+            }
+        }
+    }
+}
+
+static void
+chip8_env_reset_one(struct chip8_env *env, unsigned int i) {
+    struct chip8 *chip8 = env->machines[i];
+
+    chip8_reset(chip8);
+
+    env->scores[i] = chip8_env_score(env, chip8);
+    env->rewards[i] = 0.0f;
+    env->dones[i] = 0;
+    chip8_env_pack(env, chip8, env->obs + i * env->obs_size);
+}
+
+static void
+chip8_env_step_one(struct chip8_env *env, unsigned int i) {
+    struct chip8 *chip8 = env->machines[i];
+    unsigned int f, k, events;
+    uint16_t action;
+    uint32_t score;
+    bool done = false;
+
+    //environments that finished on the previous step start a new episode
+    if (env->dones[i]) {
+        chip8_reset(chip8);
+        env->scores[i] = chip8_env_score(env, chip8);
+    }
+
+    //each bit of the action is one key of the keypad, held down for the whole step
+    action = env->actions[i];
+    for (k = 0; k < 16; k++) {
+        chip8->key[k] = (action >> k) & 1;
+    }
+
+    for (f = 0; f < env->frameskip && !done; f++) {
+        events = chip8_run_cycles(chip8, env->config.cycles_per_frame);
+        chip8_tick_timers(chip8);
+
+        if (events & (CHIP8_EVENT_UNHANDLED | CHIP8_EVENT_EXIT)) {
+            done = true;
+        }
+        else if (env->config.done_enabled && chip8->memory[env->config.done_addr & (chip8->memory_size - 1)] == env->config.done_value) {
+            done = true;
+        }
+    }
+
+    score = chip8_env_score(env, chip8);
+    env->rewards[i] = (float)((int64_t)score - (int64_t)env->scores[i]);
+    env->scores[i] = score;
+    env->dones[i] = done;
+    chip8_env_pack(env, chip8, env->obs + i * env->obs_size);
+}
+
+static void
+chip8_env_run_shard(struct chip8_env *env, unsigned int begin, unsigned int end) {
+    unsigned int i;
+
+    for (i = begin; i < end; i++) {
+        if (env->job == CHIP8_ENV_JOB_RESET) {
+            chip8_seed(env->machines[i], env->config.seed + i);
+            chip8_env_reset_one(env, i);
+        }
+        else {
+            chip8_env_step_one(env, i);
+        }
+    }
+}
+
+static void *
+chip8_env_worker_main(void *ptr) {
+    struct chip8_env_worker *worker = ptr;
+    struct chip8_env *env = worker->env;
+    uint64_t generation = 0;
+
+    while (true) {
+        pthread_mutex_lock(&env->lock);
+        while (!env->quit && env->generation == generation) {
+            pthread_cond_wait(&env->cond_start, &env->lock);
+        }
+
+        if (env->quit) {
+            pthread_mutex_unlock(&env->lock);
+            break;
+        }
+
+        generation = env->generation;
+        pthread_mutex_unlock(&env->lock);
+
+        chip8_env_run_shard(env, worker->begin, worker->end);
+
+        pthread_mutex_lock(&env->lock);
+        if (--env->pending == 0) {
+            pthread_cond_signal(&env->cond_done);
+        }
+        pthread_mutex_unlock(&env->lock);
+    }
+
+    return NULL;
+}
+
+//hands the current job to every worker, runs the first shard here and waits for the rest
+static void
+chip8_env_dispatch(struct chip8_env *env) {
+    if (env->workers_count > 0) {
+        pthread_mutex_lock(&env->lock);
+        env->pending = env->workers_count;
+        ++env->generation;
+        pthread_cond_broadcast(&env->cond_start);
+        pthread_mutex_unlock(&env->lock);
+    }
+
+    chip8_env_run_shard(env, 0, env->first_end);
+
+    if (env->workers_count > 0) {
+        pthread_mutex_lock(&env->lock);
+        while (env->pending > 0) {
+            pthread_cond_wait(&env->cond_done, &env->lock);
+        }
+        pthread_mutex_unlock(&env->lock);
+    }
+}
+
+struct chip8_env *
+chip8_env_create(unsigned int count, const struct chip8_env_config *config) {
+    struct chip8_env *env;
+    unsigned int i, shards, begin, end;
+
+    if (count == 0 || config->reward_size > 4 || chip8_profile_quirks(config->profile) == NULL) {
+        return NULL;
+    }
+
+    env = calloc(1, sizeof(*env));
+    if (env == NULL) {
+        return NULL;
+    }
+
+    pthread_mutex_init(&env->lock, NULL);
+    pthread_cond_init(&env->cond_start, NULL);
+    pthread_cond_init(&env->cond_done, NULL);
+
+    env->config = *config;
+    env->count = count;
+    if (env->config.cycles_per_frame == 0) {
+        env->config.cycles_per_frame = CHIP8_ENV_DEFAULT_CYCLES_PER_FRAME;
+    }
+
+    env->machines = calloc(count, sizeof(*env->machines));
+    env->scores = calloc(count, sizeof(*env->scores));
+    env->hires = chip8_profile_quirks(config->profile)->schip;
+    env->obs_size = env->hires ? CHIP8_ENV_OBS_HIRES_SIZE : CHIP8_ENV_OBS_SIZE;
+    env->obs = calloc(count, env->obs_size);
+    env->rewards = calloc(count, sizeof(*env->rewards));
+    env->dones = calloc(count, sizeof(*env->dones));
+    if (env->machines == NULL || env->scores == NULL || env->obs == NULL || env->rewards == NULL || env->dones == NULL) {
+        chip8_env_destroy(env);
+        return NULL;
+    }
+
+    for (i = 0; i < count; i++) {
+        env->machines[i] = chip8_create();
+        if (env->machines[i] == NULL || !chip8_set_profile(env->machines[i], config->profile) ||
+            !chip8_load_mem(env->machines[i], config->rom, config->rom_size)) {
+            chip8_env_destroy(env);
+            return NULL;
+        }
+    }
+
+    //split the environments into one contiguous shard per thread
+    shards = config->threads > 1 ? config->threads : 1;
+    if (shards > count) {
+        shards = count;
+    }
+
+    env->first_end = count / shards + (count % shards > 0);
+    if (shards > 1) {
+        env->workers = calloc(shards - 1, sizeof(*env->workers));
+        if (env->workers == NULL) {
+            chip8_env_destroy(env);
+            return NULL;
+        }
+
+        begin = env->first_end;
+        for (i = 1; i < shards; i++) {
+            end = begin + count / shards + (count % shards > i);
+
+            env->workers[i - 1].env = env;
+            env->workers[i - 1].begin = begin;
+            env->workers[i - 1].end = end;
+            if (pthread_create(&env->workers[i - 1].thread, NULL, chip8_env_worker_main, &env->workers[i - 1]) != 0) {
+                chip8_env_destroy(env);
+                return NULL;
+            }
+
+            ++env->workers_count;
+            begin = end;
+        }
+    }
+
+    chip8_env_reset(env);
+
+    return env;
+}
+
+void
+chip8_env_destroy(struct chip8_env *env) {
+    unsigned int i;
+
+    if (env == NULL) {
+        return;
+    }
+
+    if (env->workers_count > 0) {
+        pthread_mutex_lock(&env->lock);
+        env->quit = true;
+        pthread_cond_broadcast(&env->cond_start);
+        pthread_mutex_unlock(&env->lock);
+
+        for (i = 0; i < env->workers_count; i++) {
+            pthread_join(env->workers[i].thread, NULL);
+        }
+    }
+
+    if (env->machines != NULL) {
+        for (i = 0; i < env->count; i++) {
+            chip8_destroy(env->machines[i]);
+        }
+    }
+
+    pthread_mutex_destroy(&env->lock);
+    pthread_cond_destroy(&env->cond_start);
+    pthread_cond_destroy(&env->cond_done);
+
+    free(env->workers);
+    free(env->machines);
+    free(env->scores);
+    free(env->obs);
+    free(env->rewards);
+    free(env->dones);
+    free(env);
+}
+
+//reseeds and restarts every environment
+void
+chip8_env_reset(struct chip8_env *env) {
+    env->job = CHIP8_ENV_JOB_RESET;
+    chip8_env_dispatch(env);
+}
+
+//holds down the keys in actions[i] on environment i for frameskip frames
+//observations, rewards and dones are updated in place, an environment that
+//reported done is restarted at the beginning of its next step
+void
+chip8_env_step(struct chip8_env *env, const uint16_t *actions, unsigned int frameskip) {
+    env->job = CHIP8_ENV_JOB_STEP;
+    env->actions = actions;
+    env->frameskip = frameskip > 0 ? frameskip : 1;
+    chip8_env_dispatch(env);
+}
+
+unsigned int
+chip8_env_count(const struct chip8_env *env) {
+    return env->count;
+}
+
+//bytes in each environment's slot of the observations
+size_t
+chip8_env_obs_size(const struct chip8_env *env) {
+    return env->obs_size;
+}
+
+const uint8_t *
+chip8_env_observations(const struct chip8_env *env) {
+    return env->obs;
+}
+
+const float *
+chip8_env_rewards(const struct chip8_env *env) {
+    return env->rewards;
+}
+
+const uint8_t *
+chip8_env_dones(const struct chip8_env *env) {
+    return env->dones;
+}
+
+struct chip8 *
+chip8_env_machine(struct chip8_env *env, unsigned int i) {
+    return i < env->count ? env->machines[i] : NULL;
+}
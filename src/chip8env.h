@@ -0,0 +1,59 @@
+#ifndef CHIP8ENV_H
+#define CHIP8ENV_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "chip8.h"
+
+//bytes in one packed observation, one bit per pixel with the leftmost pixel in the high bit
+//profiles with the SUPER-CHIP display use the hi-res size, low resolution frames are doubled up to it
+#define CHIP8_ENV_OBS_SIZE       (CHIP8_GFX_WIDTH * CHIP8_GFX_HEIGHT / 8)
+#define CHIP8_ENV_OBS_HIRES_SIZE (CHIP8_GFX_MAX_WIDTH * CHIP8_GFX_MAX_HEIGHT / 8)
+
+//the terminal front end's default of 120 instructions per second
+#define CHIP8_ENV_DEFAULT_CYCLES_PER_FRAME 2
+
+struct chip8_env_config {
+    const unsigned char *rom;
+    size_t rom_size;
+
+    //quirk profile every environment runs with
+    enum chip8_profile profile;
+
+    //instructions run per 60Hz frame, 0 uses the default
+    unsigned int cycles_per_frame;
+
+    //the reward for a step is how much the big endian value of reward_size bytes
+    //at reward_addr changed, a reward_size of 0 disables rewards
+    uint16_t reward_addr;
+    uint8_t reward_size;
+
+    //the episode is done once memory[done_addr] == done_value
+    bool done_enabled;
+    uint16_t done_addr;
+    uint8_t done_value;
+
+    //env i is seeded with seed + i
+    uint32_t seed;
+
+    //worker threads stepping the environments, 0 or 1 steps them on the calling thread
+    unsigned int threads;
+};
+
+struct chip8_env;
+
+struct chip8_env *chip8_env_create(unsigned int count, const struct chip8_env_config *config);
+void chip8_env_destroy(struct chip8_env *env);
+
+void chip8_env_reset(struct chip8_env *env);
+void chip8_env_step(struct chip8_env *env, const uint16_t *actions, unsigned int frameskip);
+
+unsigned int chip8_env_count(const struct chip8_env *env);
+size_t chip8_env_obs_size(const struct chip8_env *env);
+const uint8_t *chip8_env_observations(const struct chip8_env *env);
+const float *chip8_env_rewards(const struct chip8_env *env);
+const uint8_t *chip8_env_dones(const struct chip8_env *env);
+struct chip8 *chip8_env_machine(struct chip8_env *env, unsigned int i);
+
+#endif
@@ -0,0 +1,851 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "chip8.h"
+#include "chip8batch.h"
+
+//machines run in lock-step by the batch engine, each with its own seed and keys
+#define FUZZ_LANES 8
+
+//longest generated program, mutated corpus ROMs are cut down to this too
+#define FUZZ_MAX_PROGRAM 1024
+
+//instructions between timer ticks, the batch engine is compared at every tick
+#define FUZZ_FRAME_CYCLES 20
+
+#define FUZZ_MAX_CORPUS 64
+
+//the engines checked against the switch interpreter
+enum fuzz_engine {
+    FUZZ_ENGINE_TABLE,    //the generated opcode table, compared after every instruction
+    FUZZ_ENGINE_THREADED, //the computed goto interpreter, compared at every tick since it only dispatches within a run
+    FUZZ_ENGINE_BATCH,    //the lock-step batch, compared with its lanes run one at a time at every tick
+    FUZZ_ENGINE_COUNT
+};
+
+static const char *engine_names[FUZZ_ENGINE_COUNT] = {"table", "threaded", "batch"};
+
+//what the trace callback of a machine stepped on its own saw at every instruction of the current
+//tick, so the batch lane it matches can be checked whenever the batch hands that lane a whole
+//instruction through the interpreter
+struct fuzz_trace {
+    uint64_t base;
+    uint64_t before[FUZZ_FRAME_CYCLES];
+    uint64_t after[FUZZ_FRAME_CYCLES];
+    bool mismatch;
+};
+
+//one ROM to mutate programs from
+struct fuzz_rom {
+    unsigned char data[FUZZ_MAX_PROGRAM];
+    size_t size;
+};
+
+//everything a worker thread needs, allocated up front so a program costs no allocation
+struct fuzz_thread {
+    pthread_t thread;
+    uint64_t rng;
+
+    struct chip8 *reference;
+    struct chip8 *table; //runs the table or the threaded interpreter
+    struct chip8 *lanes[FUZZ_LANES];
+    struct chip8_batch *batch;
+    struct fuzz_trace traces[FUZZ_LANES];
+
+    unsigned char program[FUZZ_MAX_PROGRAM];
+    unsigned char trial[FUZZ_MAX_PROGRAM];
+
+    uint64_t programs;
+    uint64_t cycles;
+};
+
+static unsigned int opt_threads;
+static unsigned int opt_seconds = 10;
+static unsigned int opt_cycles = 2000;
+static unsigned int opt_max_divergences = 10;
+static int opt_profile = -1;
+static uint64_t opt_seed;
+static const char *opt_output = ".";
+
+static struct fuzz_rom corpus[FUZZ_MAX_CORPUS];
+static unsigned int corpus_count;
+
+static uint64_t deadline;
+static unsigned int divergences;
+static pthread_mutex_t report_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t
+time_ns() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//splitmix64, also used to derive per-program seeds and key presses from one number
+static uint64_t
+mix(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+
+    return x ^ (x >> 31);
+}
+
+static uint64_t
+next(struct fuzz_thread *t) {
+    t->rng ^= t->rng << 13;
+    t->rng ^= t->rng >> 7;
+    t->rng ^= t->rng << 17;
+
+    return t->rng;
+}
+
+static unsigned int
+below(struct fuzz_thread *t, unsigned int n) {
+    return (next(t) >> 32) * n >> 32;
+}
+
+//a random instruction for profile, biased towards opcodes the profile implements and towards
+//jumps that land inside the program so it runs for a while before falling off the end
+static uint16_t
+random_opcode(struct fuzz_thread *t, const struct chip8_quirks *quirks, size_t size) {
+    uint16_t x = below(t, 16) << 8, y = below(t, 16) << 4, nn = below(t, 256);
+    uint16_t target = CHIP8_PROGRAM_START + below(t, size / 2) * 2;
+    static const uint8_t alu[] = {0x0, 0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7, 0xE};
+    static const uint8_t misc[] = {0x07, 0x0A, 0x15, 0x18, 0x1E, 0x29, 0x33, 0x55, 0x65};
+    static const uint8_t misc_schip[] = {0x30, 0x75, 0x85};
+    unsigned int pick = below(t, 100);
+
+    if (pick < 3) {
+        return next(t);
+    }
+    else if (pick < 6) {
+        static const uint16_t system[] = {0x00E0, 0x00EE, 0x00FB, 0x00FC, 0x00FE, 0x00FF};
+
+        if (!quirks->schip) {
+            return below(t, 2) == 0 ? 0x00E0 : 0x00EE;
+        }
+
+        //00FD ends the program, keep it rare
+        if (below(t, 16) == 0) {
+            return 0x00FD;
+        }
+
+        switch (below(t, 4)) {
+            case 0:
+                return 0x00C0 | (nn & 0xF);
+            case 1:
+                if (quirks->xochip) {
+                    return 0x00D0 | (nn & 0xF);
+                }
+                //fall through
+            default:
+                return system[below(t, sizeof(system) / sizeof(*system))];
+        }
+    }
+    else if (pick < 12) {
+        return 0x1000 | target;
+    }
+    else if (pick < 16) {
+        return 0x2000 | target;
+    }
+    else if (pick < 26) {
+        switch (below(t, 4)) {
+            case 0:
+                return 0x3000 | x | nn;
+            case 1:
+                return 0x4000 | x | nn;
+            case 2:
+                return 0x5000 | x | y | (quirks->xochip && below(t, 2) == 0 ? 2 + below(t, 2) : 0);
+            default:
+                return 0x9000 | x | y;
+        }
+    }
+    else if (pick < 42) {
+        return (below(t, 2) == 0 ? 0x6000 : 0x7000) | x | nn;
+    }
+    else if (pick < 60) {
+        return 0x8000 | x | y | alu[below(t, sizeof(alu))];
+    }
+    else if (pick < 66) {
+        //point I at the font, the program itself or anywhere in memory
+        switch (below(t, 3)) {
+            case 0:
+                return 0xA000 | below(t, 0xA0);
+            case 1:
+                return 0xA000 | target;
+            default:
+                return 0xA000 | (next(t) & 0x0FFF);
+        }
+    }
+    else if (pick < 68) {
+        return 0xB000 | target;
+    }
+    else if (pick < 73) {
+        return 0xC000 | x | nn;
+    }
+    else if (pick < 82) {
+        return 0xD000 | x | y | (nn & 0xF);
+    }
+    else if (pick < 85) {
+        return 0xE000 | x | (below(t, 2) == 0 ? 0x9E : 0xA1);
+    }
+    else if (quirks->xochip && pick < 88) {
+        switch (below(t, 4)) {
+            case 0:
+                return 0xF000;
+            case 1:
+                return 0xF002;
+            case 2:
+                return 0xF001 | x;
+            default:
+                return 0xF03A | x;
+        }
+    }
+    else if (quirks->schip && pick < 91) {
+        return 0xF000 | x | misc_schip[below(t, sizeof(misc_schip))];
+    }
+
+    return 0xF000 | x | misc[below(t, sizeof(misc))];
+}
+
+static void
+put_opcode(unsigned char *program, size_t at, uint16_t opcode) {
+    program[at] = opcode >> 8;
+    program[at + 1] = opcode & 0xFF;
+}
+
+static size_t
+generate(struct fuzz_thread *t, const struct chip8_quirks *quirks, unsigned char *program) {
+    size_t size = (8 + below(t, FUZZ_MAX_PROGRAM / 2 - 8)) * 2, at;
+
+    for (at = 0; at < size; at += 2) {
+        put_opcode(program, at, random_opcode(t, quirks, size));
+    }
+
+    return size;
+}
+
+//a corpus ROM with a handful of bit flips, replaced, inserted and deleted instructions
+static size_t
+mutate(struct fuzz_thread *t, const struct chip8_quirks *quirks, unsigned char *program) {
+    const struct fuzz_rom *rom = &corpus[below(t, corpus_count)];
+    size_t size = rom->size & ~(size_t)1, at;
+    unsigned int count = 1 + below(t, 8), i;
+
+    memcpy(program, rom->data, size);
+
+    for (i = 0; i < count && size >= 4; i++) {
+        at = below(t, size / 2) * 2;
+
+        switch (below(t, 4)) {
+            case 0:
+                program[at + below(t, 2)] ^= 1 << below(t, 8);
+                break;
+            case 1:
+                put_opcode(program, at, random_opcode(t, quirks, size));
+                break;
+            case 2:
+                if (size + 2 <= FUZZ_MAX_PROGRAM) {
+                    memmove(program + at + 2, program + at, size - at);
+                    size += 2;
+                    put_opcode(program, at, random_opcode(t, quirks, size));
+                }
+                break;
+            default:
+                memmove(program + at, program + at + 2, size - at - 2);
+                size -= 2;
+                break;
+        }
+    }
+
+    return size;
+}
+
+//a program's keypad for one tick, about a quarter of the keys held down
+static void
+press_keys(struct chip8 *chip8, uint64_t seed, unsigned int lane, unsigned int frame) {
+    uint64_t h = mix(seed ^ (uint64_t)lane << 48 ^ frame);
+    int i;
+
+    for (i = 0; i < 16; i++) {
+        chip8->key[i] = (h >> i) & (h >> (i + 16)) & 1;
+    }
+}
+
+//the registers and timers as one number, for the trace callbacks
+static uint64_t
+hash_registers(const struct chip8 *chip8) {
+    uint64_t h;
+    int i;
+
+    h = mix(chip8->pc ^ (uint64_t)chip8->I << 16 ^ (uint64_t)chip8->opcode << 32 ^ (uint64_t)chip8->sp << 48);
+    h = mix(h ^ chip8->dt ^ chip8->st << 8 ^ (uint64_t)chip8->rng << 16);
+    h = mix(h ^ chip8->cycles);
+    for (i = 0; i < 16; i++) {
+        h = mix(h ^ chip8->V[i]);
+    }
+
+    return h;
+}
+
+//the slot of the current tick the instruction being traced falls in, NULL past the end of it
+static uint64_t *
+trace_slot(struct fuzz_trace *trace, const struct chip8 *chip8, const char *state) {
+    bool after = strcmp(state, "After Handler") == 0;
+    uint64_t i = chip8->cycles - after - trace->base;
+
+    if (i >= FUZZ_FRAME_CYCLES) {
+        return NULL;
+    }
+
+    return after ? &trace->after[i] : &trace->before[i];
+}
+
+//traces the machines stepped on their own
+static void
+trace_record(void *ctx, const struct chip8 *chip8, const char *state) {
+    uint64_t *slot = trace_slot(ctx, chip8, state);
+
+    if (slot != NULL) {
+        *slot = hash_registers(chip8);
+    }
+}
+
+//traces the batch's lanes, which have to look exactly like their machine stepped on its own did
+static void
+trace_check(void *ctx, const struct chip8 *chip8, const char *state) {
+    struct fuzz_trace *trace = ctx;
+    uint64_t *slot = trace_slot(trace, chip8, state);
+
+    if (slot == NULL || *slot != hash_registers(chip8)) {
+        trace->mismatch = true;
+    }
+}
+
+//registers and timers, cheap enough to compare after every instruction
+static bool
+same_registers(const struct chip8 *a, const struct chip8 *b) {
+    return a->pc == b->pc && a->I == b->I && a->sp == b->sp && a->dt == b->dt && a->st == b->st &&
+           a->cycles == b->cycles && a->sound_on_cycle == b->sound_on_cycle &&
+           a->sound_off_cycle == b->sound_off_cycle && a->rng == b->rng && a->planes == b->planes && a->pitch == b->pitch &&
+           a->gfx_width == b->gfx_width && a->gfx_height == b->gfx_height &&
+           memcmp(a->V, b->V, sizeof(a->V)) == 0 &&
+           memcmp(a->stack, b->stack, sizeof(a->stack)) == 0;
+}
+
+static bool
+same_state(const struct chip8 *a, const struct chip8 *b) {
+    return same_registers(a, b) && a->memory_size == b->memory_size && a->gfx_dirty == b->gfx_dirty &&
+           memcmp(a->memory, b->memory, a->memory_size) == 0 &&
+           memcmp(a->gfx, b->gfx, sizeof(a->gfx)) == 0 &&
+           memcmp(a->flags, b->flags, sizeof(a->flags)) == 0 &&
+           memcmp(a->audio_pattern, b->audio_pattern, sizeof(a->audio_pattern)) == 0;
+}
+
+//puts a machine back to power-on for program, the flags are cleared too since they survive resets
+static void
+prepare(struct chip8 *chip8, enum chip8_profile profile, enum chip8_dispatch dispatch, uint32_t seed,
+        const unsigned char *program, size_t size) {
+    chip8_set_profile(chip8, profile);
+    chip8_set_dispatch(chip8, dispatch);
+    chip8_seed(chip8, seed);
+    chip8_load_mem(chip8, program, size);
+    memset(chip8->flags, 0, sizeof(chip8->flags));
+    chip8->gfx_dirty = 0;
+}
+
+//runs the switch and the table side by side
+//returns the instruction the two first disagree after, or UINT64_MAX if they never do
+//the memory and framebuffer are compared once per tick unless every_cycle is set
+static uint64_t
+run_table(struct fuzz_thread *t, const unsigned char *program, size_t size, enum chip8_profile profile,
+          uint64_t seed, unsigned int cycles, bool every_cycle) {
+    struct chip8 *a = t->reference, *b = t->table;
+    unsigned int events_a, events_b, cycle, frame;
+    bool running_a, running_b;
+
+    prepare(a, profile, CHIP8_DISPATCH_SWITCH, seed, program, size);
+    prepare(b, profile, CHIP8_DISPATCH_TABLE, seed, program, size);
+
+    for (cycle = 0; cycle < cycles; cycle++) {
+        frame = cycle / FUZZ_FRAME_CYCLES;
+        if (cycle % FUZZ_FRAME_CYCLES == 0) {
+            press_keys(a, seed, 0, frame);
+            press_keys(b, seed, 0, frame);
+        }
+
+        events_a = events_b = 0;
+        running_a = chip8_cycle(a, &events_a);
+        running_b = chip8_cycle(b, &events_b);
+        t->cycles += 2;
+
+        if (running_a != running_b || events_a != events_b || !same_registers(a, b) ||
+            ((every_cycle || !running_a) && !same_state(a, b))) {
+            return cycle;
+        }
+
+        if (!running_a) {
+            return UINT64_MAX;
+        }
+
+        if (cycle % FUZZ_FRAME_CYCLES == FUZZ_FRAME_CYCLES - 1) {
+            chip8_tick_timers(a);
+            chip8_tick_timers(b);
+
+            if (!same_state(a, b)) {
+                return cycle;
+            }
+        }
+    }
+
+    return UINT64_MAX;
+}
+
+//runs the switch and the threaded interpreter a tick at a time with chip8_run_cycles()
+//returns the last instruction of the first tick the two disagree at, or UINT64_MAX
+static uint64_t
+run_threaded(struct fuzz_thread *t, const unsigned char *program, size_t size, enum chip8_profile profile,
+             uint64_t seed, unsigned int cycles) {
+    struct chip8 *a = t->reference, *b = t->table;
+    unsigned int frame, frames = (cycles + FUZZ_FRAME_CYCLES - 1) / FUZZ_FRAME_CYCLES, events_a, events_b;
+
+    prepare(a, profile, CHIP8_DISPATCH_SWITCH, seed, program, size);
+    prepare(b, profile, CHIP8_DISPATCH_THREADED, seed, program, size);
+
+    for (frame = 0; frame < frames; frame++) {
+        press_keys(a, seed, 0, frame);
+        press_keys(b, seed, 0, frame);
+
+        events_a = chip8_run_cycles(a, FUZZ_FRAME_CYCLES);
+        events_b = chip8_run_cycles(b, FUZZ_FRAME_CYCLES);
+        t->cycles += FUZZ_FRAME_CYCLES * 2;
+
+        chip8_tick_timers(a);
+        chip8_tick_timers(b);
+
+        if (events_a != events_b || !same_state(a, b)) {
+            return (uint64_t)(frame + 1) * FUZZ_FRAME_CYCLES - 1;
+        }
+
+        if (events_a & (CHIP8_EVENT_UNHANDLED | CHIP8_EVENT_EXIT)) {
+            break;
+        }
+    }
+
+    return UINT64_MAX;
+}
+
+//runs every lane of the batch against a machine of its own stepped with chip8_cycle()
+//every instruction the batch runs through the interpreter, such as DXYN, is traced and has to
+//show the lane's registers exactly as its own machine had them
+//returns the last instruction of the first tick the two disagree at, or UINT64_MAX
+static uint64_t
+run_batch(struct fuzz_thread *t, const unsigned char *program, size_t size, enum chip8_profile profile,
+          uint64_t seed, unsigned int cycles) {
+    struct chip8 *lane;
+    unsigned int frame, frames = (cycles + FUZZ_FRAME_CYCLES - 1) / FUZZ_FRAME_CYCLES, l, i, events;
+    bool halted[FUZZ_LANES], running;
+
+    for (l = 0; l < FUZZ_LANES; l++) {
+        prepare(chip8_batch_lane(t->batch, l), profile, CHIP8_DISPATCH_SWITCH, seed + l, program, size);
+        prepare(t->lanes[l], profile, CHIP8_DISPATCH_SWITCH, seed + l, program, size);
+        halted[l] = false;
+    }
+
+    chip8_batch_gather(t->batch);
+
+    for (frame = 0; frame < frames; frame++) {
+        running = false;
+        for (l = 0; l < FUZZ_LANES; l++) {
+            press_keys(chip8_batch_lane(t->batch, l), seed, l, frame);
+            press_keys(t->lanes[l], seed, l, frame);
+
+            memset(&t->traces[l], 0, sizeof(t->traces[l]));
+            t->traces[l].base = t->lanes[l]->cycles;
+
+            //the batch runs every lane for the whole count, stopping lanes that halt and,
+            //like chip8_run_cycles(), lanes that start waiting for a key until the next tick
+            events = 0;
+            for (i = 0; i < FUZZ_FRAME_CYCLES && !halted[l] && !(events & CHIP8_EVENT_KEY_WAIT); i++) {
+                halted[l] = !chip8_cycle(t->lanes[l], &events);
+            }
+
+            chip8_tick_timers(t->lanes[l]);
+            running |= !halted[l];
+        }
+
+        chip8_batch_run_cycles(t->batch, FUZZ_FRAME_CYCLES);
+        chip8_batch_tick_timers(t->batch);
+        chip8_batch_scatter(t->batch);
+        t->cycles += FUZZ_LANES * FUZZ_FRAME_CYCLES * 2;
+
+        for (l = 0; l < FUZZ_LANES; l++) {
+            lane = chip8_batch_lane(t->batch, l);
+            if ((t->batch->running[l] == 0) != halted[l] || t->traces[l].mismatch || !same_state(lane, t->lanes[l])) {
+                return (uint64_t)(frame + 1) * FUZZ_FRAME_CYCLES - 1;
+            }
+        }
+
+        if (!running) {
+            break;
+        }
+    }
+
+    return UINT64_MAX;
+}
+
+static uint64_t
+run(struct fuzz_thread *t, enum fuzz_engine engine, const unsigned char *program, size_t size,
+    enum chip8_profile profile, uint64_t seed, unsigned int cycles, bool every_cycle) {
+    if (engine == FUZZ_ENGINE_TABLE) {
+        return run_table(t, program, size, profile, seed, cycles, every_cycle);
+    }
+
+    if (engine == FUZZ_ENGINE_THREADED) {
+        return run_threaded(t, program, size, profile, seed, cycles);
+    }
+
+    return run_batch(t, program, size, profile, seed, cycles);
+}
+
+//shrinks a diverging program while it keeps diverging: the run is cut to the first divergence,
+//the program to the shortest prefix and then every instruction that isn't needed becomes 8000,
+//which copies V0 to itself
+//returns the new size, program and cycles are updated in place
+static size_t
+minimize(struct fuzz_thread *t, enum fuzz_engine engine, unsigned char *program, size_t size,
+         enum chip8_profile profile, uint64_t seed, unsigned int *cycles) {
+    unsigned char *trial = t->trial;
+    uint64_t at;
+    size_t chunk, i;
+
+    at = run(t, engine, program, size, profile, seed, *cycles, true);
+    if (at == UINT64_MAX) {
+        return size;
+    }
+    *cycles = at + 1;
+
+    for (chunk = size / 2 & ~(size_t)1; chunk >= 2; chunk = chunk / 2 & ~(size_t)1) {
+        while (size >= chunk + 2 && run(t, engine, program, size - chunk, profile, seed, *cycles, true) != UINT64_MAX) {
+            size -= chunk;
+        }
+    }
+
+    memcpy(trial, program, size);
+    for (i = 0; i < size; i += 2) {
+        if (program[i] == 0x80 && program[i + 1] == 0x00) {
+            continue;
+        }
+
+        put_opcode(trial, i, 0x8000);
+        if (run(t, engine, trial, size, profile, seed, *cycles, true) != UINT64_MAX) {
+            program[i] = 0x80;
+            program[i + 1] = 0x00;
+        }
+        else {
+            trial[i] = program[i];
+            trial[i + 1] = program[i + 1];
+        }
+    }
+
+    at = run(t, engine, program, size, profile, seed, *cycles, true);
+    if (at != UINT64_MAX) {
+        *cycles = at + 1;
+    }
+
+    return size;
+}
+
+//minimizes and saves a divergence as <output>/diverge-<engine>-<hash>.ch8
+static void
+report(struct fuzz_thread *t, enum fuzz_engine engine, const unsigned char *original, size_t size,
+       enum chip8_profile profile, uint64_t seed, uint64_t at) {
+    unsigned char *program = t->program;
+    unsigned int cycles = opt_cycles;
+    char path[4096];
+    uint64_t hash = 0;
+    size_t i;
+    FILE *f;
+
+    if (program != original) {
+        memcpy(program, original, size);
+    }
+
+    size = minimize(t, engine, program, size, profile, seed, &cycles);
+
+    for (i = 0; i < size; i++) {
+        hash = mix(hash ^ program[i]);
+    }
+
+    snprintf(path, sizeof(path), "%s/diverge-%s-%016llX.ch8", opt_output, engine_names[engine], (unsigned long long)hash);
+
+    pthread_mutex_lock(&report_lock);
+
+    f = fopen(path, "wb");
+    if (f != NULL) {
+        fwrite(program, 1, size, f);
+        fclose(f);
+    }
+
+    printf("%s diverged from switch: profile %s, seed 0x%016llX, at instruction %llu, reproduced in %u instructions by %s (%zu bytes)\n",
+           engine_names[engine], chip8_profile_name(profile), (unsigned long long)seed, (unsigned long long)at,
+           cycles, f != NULL ? path : "(could not write)", size);
+    fflush(stdout);
+
+    ++divergences;
+
+    pthread_mutex_unlock(&report_lock);
+}
+
+static bool
+done() {
+    bool stop;
+
+    pthread_mutex_lock(&report_lock);
+    stop = divergences >= opt_max_divergences;
+    pthread_mutex_unlock(&report_lock);
+
+    return stop || time_ns() >= deadline;
+}
+
+static void *
+worker(void *arg) {
+    struct fuzz_thread *t = arg;
+    const struct chip8_quirks *quirks;
+    enum chip8_profile profile;
+    enum fuzz_engine engine;
+    uint64_t seed, at;
+    size_t size;
+
+    while (!done()) {
+        profile = opt_profile >= 0 ? (enum chip8_profile)opt_profile : below(t, CHIP8_PROFILE_COUNT);
+        quirks = chip8_profile_quirks(profile);
+        seed = next(t);
+
+        if (corpus_count > 0 && below(t, 2) == 0) {
+            size = mutate(t, quirks, t->program);
+        }
+        else {
+            size = generate(t, quirks, t->program);
+        }
+
+        if (size < 2) {
+            continue;
+        }
+
+        for (engine = 0; engine < FUZZ_ENGINE_COUNT; engine++) {
+            at = run(t, engine, t->program, size, profile, seed, opt_cycles, false);
+            if (at != UINT64_MAX) {
+                report(t, engine, t->program, size, profile, seed, at);
+                break;
+            }
+        }
+
+        ++t->programs;
+    }
+
+    return NULL;
+}
+
+static bool
+load_corpus(const char *path) {
+    struct fuzz_rom *rom;
+    FILE *f;
+
+    if (corpus_count == FUZZ_MAX_CORPUS) {
+        return true;
+    }
+
+    f = fopen(path, "rb");
+    if (f == NULL) {
+        return false;
+    }
+
+    rom = &corpus[corpus_count];
+    rom->size = fread(rom->data, 1, sizeof(rom->data), f);
+    fclose(f);
+
+    if (rom->size >= 2) {
+        ++corpus_count;
+    }
+
+    return true;
+}
+
+static void
+destroy_thread(struct fuzz_thread *t) {
+    unsigned int l;
+
+    chip8_destroy(t->reference);
+    chip8_destroy(t->table);
+    for (l = 0; l < FUZZ_LANES; l++) {
+        chip8_destroy(t->lanes[l]);
+    }
+    chip8_batch_destroy(t->batch);
+}
+
+static bool
+create_thread(struct fuzz_thread *t, unsigned int id) {
+    struct chip8_callbacks callbacks;
+    unsigned int l;
+    bool success;
+
+    memset(t, 0, sizeof(*t));
+    t->rng = mix(opt_seed + id) | 1;
+
+    t->reference = chip8_create();
+    t->table = chip8_create();
+    t->batch = chip8_batch_create(FUZZ_LANES);
+    success = t->reference != NULL && t->table != NULL && t->batch != NULL;
+
+    for (l = 0; l < FUZZ_LANES; l++) {
+        t->lanes[l] = chip8_create();
+        success = success && t->lanes[l] != NULL;
+    }
+
+    if (!success) {
+        destroy_thread(t);
+        return false;
+    }
+
+    memset(&callbacks, 0, sizeof(callbacks));
+    for (l = 0; l < FUZZ_LANES; l++) {
+        callbacks.ctx = &t->traces[l];
+        callbacks.trace = trace_record;
+        chip8_set_callbacks(t->lanes[l], &callbacks);
+        callbacks.trace = trace_check;
+        chip8_set_callbacks(chip8_batch_lane(t->batch, l), &callbacks);
+    }
+
+    return success;
+}
+
+static void
+usage(const char *fmt, ...) {
+    va_list ap;
+
+    if (fmt != NULL) {
+        va_start(ap, fmt);
+        vprintf(fmt, ap);
+        va_end(ap);
+
+        fputc('\n', stdout);
+    }
+
+    puts("Usage: chip8fuzz [options] [rom path]...");
+    puts("Runs random programs through every engine on all cores and reports where one disagrees with the");
+    puts("switch interpreter, saving a minimized ROM that reproduces it. ROMs given are mutated as well.");
+    puts("Options:");
+    puts(" -t <threads> Worker threads. The default is one per core.");
+    puts(" -d <seconds> How long to run for. The default is 10.");
+    puts(" -c <count>   Instructions per program. The default is 2000.");
+    puts(" -m <count>   Stop after this many divergences. The default is 10.");
+    puts(" -q <quirks>  Quirk profile to fuzz. The default is a random one for every program.");
+    puts(" -s <seed>    Seed for the program generator. The default is the time.");
+    puts(" -o <dir>     Where to save the reproducing ROMs. The default is the current directory.");
+}
+
+int
+main(int argc, char **argv) {
+    struct fuzz_thread *threads;
+    enum chip8_profile profile;
+    uint64_t start, elapsed, programs = 0, cycles = 0;
+    unsigned int i;
+    int arg;
+
+    opt_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    opt_seed = time_ns();
+
+    for (arg = 1; arg < argc; arg++) {
+        if (strcmp(argv[arg], "-t") == 0 && arg + 1 < argc) {
+            opt_threads = atoi(argv[++arg]);
+        }
+        else if (strcmp(argv[arg], "-d") == 0 && arg + 1 < argc) {
+            opt_seconds = atoi(argv[++arg]);
+        }
+        else if (strcmp(argv[arg], "-c") == 0 && arg + 1 < argc) {
+            opt_cycles = atoi(argv[++arg]);
+        }
+        else if (strcmp(argv[arg], "-m") == 0 && arg + 1 < argc) {
+            opt_max_divergences = atoi(argv[++arg]);
+        }
+        else if (strcmp(argv[arg], "-q") == 0 && arg + 1 < argc) {
+            if (!chip8_profile_find(argv[++arg], &profile)) {
+                usage("Invalid quirk profile");
+                return 1;
+            }
+            opt_profile = profile;
+        }
+        else if (strcmp(argv[arg], "-s") == 0 && arg + 1 < argc) {
+            opt_seed = strtoull(argv[++arg], NULL, 0);
+        }
+        else if (strcmp(argv[arg], "-o") == 0 && arg + 1 < argc) {
+            opt_output = argv[++arg];
+        }
+        else if (argv[arg][0] == '-') {
+            usage("Unknown option %s", argv[arg]);
+            return 1;
+        }
+        else if (!load_corpus(argv[arg])) {
+            usage("Could not load %s", argv[arg]);
+            return 1;
+        }
+    }
+
+    if (opt_threads == 0) {
+        opt_threads = 1;
+    }
+
+    if (opt_cycles == 0) {
+        usage("Invalid instruction count");
+        return 1;
+    }
+
+    threads = calloc(opt_threads, sizeof(*threads));
+    if (threads == NULL) {
+        return 1;
+    }
+
+    for (i = 0; i < opt_threads; i++) {
+        if (!create_thread(&threads[i], i)) {
+            return 1;
+        }
+    }
+
+    printf("Fuzzing with %u threads for %u seconds, seed 0x%016llX, %u corpus ROMs\n",
+           opt_threads, opt_seconds, (unsigned long long)opt_seed, corpus_count);
+    fflush(stdout);
+
+    start = time_ns();
+    deadline = start + opt_seconds * 1000000000ULL;
+
+    for (i = 0; i < opt_threads; i++) {
+        pthread_create(&threads[i].thread, NULL, worker, &threads[i]);
+    }
+
+    for (i = 0; i < opt_threads; i++) {
+        pthread_join(threads[i].thread, NULL);
+        programs += threads[i].programs;
+        cycles += threads[i].cycles;
+        destroy_thread(&threads[i]);
+    }
+
+    elapsed = time_ns() - start;
+
+    printf("%llu programs, %.1f million instructions, %.1f million programs per hour, %u divergences\n",
+           (unsigned long long)programs, cycles / 1000000.0,
+           elapsed > 0 ? programs * 3600000.0 / elapsed : 0.0, divergences);
+
+    free(threads);
+
+    return divergences > 0 ? 1 : 0;
+}
@@ -0,0 +1,728 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "chip8.h"
+#include "chip8db.h"
+#include "chip8env.h"
+
+#define MAX_CASES       256
+#define MAX_CHECKPOINTS 64
+#define MAX_LINE        4096
+
+//env: cases step this many environments on this many threads, so the shards come out uneven
+#define ENV_LANES     5
+#define ENV_THREADS   3
+#define ENV_FRAMESKIP 4
+
+//where the env: ROMs keep their score and done flag, both past the end of 4KB so they wrap
+#define ENV_REWARD_ADDR 0xFFFF
+#define ENV_DONE_ADDR   0x1000
+#define ENV_DONE_VALUE  0x30
+
+//a ROM built into the suite, for opcodes the bundled games never hit the corners of
+struct builtin {
+    const char *name;
+    const unsigned char *rom;
+    size_t size;
+};
+
+//one line of the golden file: what to run, and the state hash expected at every checkpoint
+struct regress_case {
+    char rom[256];
+    enum chip8_profile profile;
+    unsigned int frames;
+    unsigned int cycles;
+    unsigned int every;
+
+    uint64_t golden[MAX_CHECKPOINTS];
+    unsigned int golden_count;
+
+    //filled in by the workers, one set per dispatch strategy
+    uint64_t actual[CHIP8_DISPATCH_COUNT][MAX_CHECKPOINTS];
+    unsigned int actual_count;
+    bool loaded;
+
+    //what an env: case found wrong on top of the hashes, empty if nothing
+    char failure[CHIP8_DISPATCH_COUNT][128];
+};
+
+//8XY4-8XYE and FX1E with VF as an operand, then V2-V9 drawn as hex digits
+//every flag is worked out from the operands and written last
+static const unsigned char alu_flags[] = {
+    0x60, 0xFE, 0x61, 0x01, 0x80, 0x14, 0x82, 0xF0, //0x200 FE + 01 has no carry
+    0x6F, 0xFF, 0x6E, 0x01, 0x8F, 0xE4, 0x83, 0xF0, //0x208 VF += VE carries
+    0x60, 0x05, 0x61, 0x03, 0x80, 0x15, 0x84, 0xF0, //0x210 05 - 03 has no borrow
+    0x6F, 0x03, 0x6E, 0x05, 0x8F, 0xE5, 0x85, 0xF0, //0x218 VF -= VE borrows
+    0x6F, 0x81, 0x8F, 0xF6, 0x86, 0xF0,             //0x220 VF >>= 1 shifts a 1 out
+    0x6F, 0x81, 0x8F, 0xFE, 0x87, 0xF0,             //0x226 VF <<= 1 shifts a 1 out
+    0x6F, 0x05, 0x6E, 0x03, 0x8F, 0xE7, 0x88, 0xF0, //0x22C VF = VE - VF borrows
+    0xAF, 0xF0, 0x6F, 0x20, 0xFF, 0x1E, 0x89, 0xF0, //0x234 I += VF overflows past 0xFFF
+    0xA3, 0x00, 0xF9, 0x55,                         //0x23C V0-V9 to 0x300
+    0x6A, 0x00, 0x6B, 0x00,                         //0x240
+    0xF2, 0x29, 0xDA, 0xB5, 0x7A, 0x05,             //0x244
+    0xF3, 0x29, 0xDA, 0xB5, 0x7A, 0x05,
+    0xF4, 0x29, 0xDA, 0xB5, 0x7A, 0x05,
+    0xF5, 0x29, 0xDA, 0xB5, 0x7A, 0x05,
+    0xF6, 0x29, 0xDA, 0xB5, 0x7A, 0x05,
+    0xF7, 0x29, 0xDA, 0xB5, 0x7A, 0x05,
+    0xF8, 0x29, 0xDA, 0xB5, 0x7A, 0x05,
+    0xF9, 0x29, 0xDA, 0xB5, 0x7A, 0x05,
+    0x12, 0x74                                      //0x274 halt
+};
+
+//FX33, FX55, FX65 and DXYN reaching past the end of memory and the screen, plus nested calls
+static const unsigned char memory_edges[] = {
+    0x60, 0x12, 0xAF, 0xFE, 0xF0, 0x33,             //0x200 BCD of 18 at 0xFFE wraps to 0x000
+    0x61, 0x01, 0x62, 0x02, 0x63, 0x03,             //0x206
+    0xAF, 0xFE, 0xF3, 0x55,                         //0x20C V0-V3 at 0xFFE wraps
+    0xAF, 0xFB, 0x6A, 0x3C, 0x6B, 0x1E, 0xDA, 0xBF, //0x210 15 rows from 0xFFB at (60, 30)
+    0x6C, 0x0A, 0xFC, 0x29,                         //0x218
+    0x6A, 0x3E, 0x6B, 0x1D, 0xDA, 0xB5,             //0x21C font A at (62, 29)
+    0x22, 0x2A,                                     //0x222
+    0xAF, 0xFF, 0xF2, 0x65,                         //0x224 V0-V2 from 0xFFF wraps
+    0x12, 0x28,                                     //0x228 halt
+    0x22, 0x2E, 0x00, 0xEE,                         //0x22A
+    0x7D, 0x01, 0x00, 0xEE                          //0x22E
+};
+
+//a subroutine calling itself until the stack runs out, which halts the machine
+static const unsigned char stack_overflow[] = {
+    0x70, 0x01, 0x22, 0x00                          //0x200
+};
+
+//SUPER-CHIP hi-res drawing, scrolling, the big font and the RPL flags
+static const unsigned char hires[] = {
+    0x00, 0xFF, 0x6A, 0x78, 0x6B, 0x3A,             //0x200 16x16 sprite at (120, 58)
+    0xA2, 0x00, 0xDA, 0xB0,                         //0x206
+    0x00, 0xC4, 0x00, 0xFB, 0x00, 0xFC, 0x00, 0xFB, //0x20A
+    0x60, 0x07, 0xF0, 0x30,                         //0x212 big 7 at (0, 0)
+    0x6A, 0x00, 0x6B, 0x00, 0xDA, 0xBA,             //0x216
+    0x61, 0x55, 0x62, 0x66, 0xF2, 0x75,             //0x21C
+    0x60, 0x00, 0x61, 0x00, 0x62, 0x00, 0xF2, 0x85, //0x222
+    0x00, 0xFE, 0xF0, 0x29,                         //0x22A low res, small 7 at (60, 28)
+    0x6A, 0x3C, 0x6B, 0x1C, 0xDA, 0xB5,             //0x22E
+    0x12, 0x34                                      //0x234 halt
+};
+
+//XO-CHIP long loads, register ranges, 64KB wrap-around, bitplanes, audio and long skips
+static const unsigned char xochip[] = {
+    0xF0, 0x00, 0xFF, 0xF0,                         //0x200 I = 0xFFF0
+    0x60, 0x11, 0x61, 0x22, 0x62, 0x33, 0x50, 0x22, //0x204
+    0x60, 0x00, 0x61, 0x00, 0x62, 0x00, 0x50, 0x23, //0x20C
+    0xF0, 0x00, 0xFF, 0xFE, 0xF2, 0x55,             //0x214 V0-V2 at 0xFFFE wraps
+    0xF3, 0x01, 0xA2, 0x00,                         //0x21A both planes
+    0x6A, 0x3C, 0x6B, 0x1E, 0xDA, 0xB8,             //0x21E
+    0x00, 0xD3,                                     //0x224
+    0xA2, 0x00, 0xF0, 0x02, 0x60, 0x80, 0xF0, 0x3A, //0x226
+    0x60, 0x01, 0x30, 0x01,                         //0x22E
+    0xF0, 0x00, 0x00, 0x00,                         //0x232 skipped as a whole
+    0x12, 0x36                                      //0x236 halt
+};
+
+//FX1E carrying I past 0xFFF, which sets VF on every profile but XO-CHIP, then VF drawn as a hex digit
+static const unsigned char add_i[] = {
+    0x6F, 0x07, 0xAF, 0xFF, 0x60, 0x02, 0xF0, 0x1E, //0x200 VF = 7, I = 0xFFF + 2
+    0xFF, 0x29, 0xDA, 0xB5,                         //0x208
+    0x12, 0x0C                                      //0x20C halt
+};
+
+//a 16 bit score at 0xFFF and 0x000 starting from 0x700, raised by 1 every loop or by 3 while key 1
+//is down, with its low digit drawn across the screen; run through the env API it's rewarded and
+//done at 0x30 through addresses that only work once wrapped to memory
+static const unsigned char score[] = {
+    0x60, 0x07, 0x61, 0x00, 0x6A, 0x00, 0x6B, 0x00, //0x200
+    0x62, 0x01, 0xE2, 0xA1, 0x71, 0x02, 0x71, 0x01, //0x208 key 1 adds 2 more
+    0xAF, 0xFF, 0xF1, 0x55,                         //0x210 V0-V1 at 0xFFF wraps
+    0xF1, 0x29, 0xDA, 0xB5, 0x7A, 0x05, 0x7B, 0x03, //0x214
+    0x12, 0x08                                      //0x21C
+};
+
+static const struct builtin builtins[] = {
+    {"alu_flags", alu_flags, sizeof(alu_flags)},
+    {"memory_edges", memory_edges, sizeof(memory_edges)},
+    {"stack_overflow", stack_overflow, sizeof(stack_overflow)},
+    {"hires", hires, sizeof(hires)},
+    {"xochip", xochip, sizeof(xochip)},
+    {"add_i", add_i, sizeof(add_i)},
+    {"score", score, sizeof(score)},
+    {NULL, NULL, 0}
+};
+
+static unsigned int opt_threads;
+static bool opt_update = false;
+static bool opt_verbose = false;
+
+//where ROM names in the golden file are looked up
+static char rom_dir[MAX_LINE];
+
+static struct regress_case cases[MAX_CASES];
+static unsigned int cases_count;
+
+static unsigned int next_job;
+static pthread_mutex_t job_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t
+time_ns() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//the scripted input: a scrambled key every 10 frames, held down for 6 of them, so games start
+//from the first frame and every key keeps being pressed throughout the run
+//returns the key held down at frame, or -1 when none is
+static int
+movie_key(unsigned int frame) {
+    //the top bits of a Fibonacci hash, the low ones barely change from one window to the next
+    return frame % 10 < 6 ? (int)((uint32_t)(frame / 10 * 2654435761U) >> 28) : -1;
+}
+
+static void
+play_movie(struct chip8 *chip8, unsigned int frame) {
+    int key = movie_key(frame);
+
+    memset(chip8->key, 0, sizeof(chip8->key));
+    if (key >= 0) {
+        chip8->key[key] = 1;
+    }
+}
+
+//the framebuffer, registers, I and memory folded into one number
+static uint64_t
+hash_state(const struct chip8 *chip8) {
+    uint64_t h;
+
+    h = chip8_rom_hash((const unsigned char *)chip8->gfx, sizeof(chip8->gfx));
+    h = h * 31 + chip8_rom_hash(chip8->V, sizeof(chip8->V));
+    h = h * 31 + chip8->I;
+    h = h * 31 + chip8_rom_hash(chip8->memory, chip8->memory_size);
+
+    return h;
+}
+
+static const struct builtin *
+find_builtin(const char *name) {
+    int i;
+
+    for (i = 0; builtins[i].name != NULL; i++) {
+        if (strcmp(builtins[i].name, name) == 0) {
+            return &builtins[i];
+        }
+    }
+
+    return NULL;
+}
+
+static bool
+load(struct chip8 *chip8, const char *rom) {
+    const struct builtin *builtin;
+    char path[MAX_LINE * 2];
+
+    if (strncmp(rom, "builtin:", 8) == 0) {
+        builtin = find_builtin(rom + 8);
+
+        return builtin != NULL && chip8_load_mem(chip8, builtin->rom, builtin->size);
+    }
+
+    snprintf(path, sizeof(path), "%s/%s", rom_dir, rom);
+
+    return chip8_load(chip8, path);
+}
+
+static uint32_t
+env_score(const struct chip8 *chip8) {
+    return chip8->memory[ENV_REWARD_ADDR % chip8->memory_size] << 8 |
+           chip8->memory[(ENV_REWARD_ADDR + 1) % chip8->memory_size];
+}
+
+//the observation worked out a pixel at a time, low resolution doubled when hires is set
+static void
+env_expected_obs(const struct chip8 *chip8, bool hires, uint8_t *obs, size_t size) {
+    unsigned int x, y, px, py, width = hires ? CHIP8_GFX_MAX_WIDTH : CHIP8_GFX_WIDTH;
+    unsigned int height = hires ? CHIP8_GFX_MAX_HEIGHT : CHIP8_GFX_HEIGHT;
+    bool doubled = hires && chip8->gfx_width != CHIP8_GFX_MAX_WIDTH;
+    uint64_t word;
+
+    memset(obs, 0, size);
+    for (y = 0; y < height; y++) {
+        for (x = 0; x < width; x++) {
+            px = doubled ? x / 2 : x;
+            py = doubled ? y / 2 : y;
+            word = chip8->gfx[0][py][px / 64] | chip8->gfx[1][py][px / 64];
+            if ((word >> (63 - px % 64)) & 1) {
+                obs[(y * width + x) / 8] |= 0x80 >> (x % 8);
+            }
+        }
+    }
+}
+
+//steps a builtin ROM through the env API with a different movie offset for every environment, and
+//checks each step against a machine of its own stepped the same way one frame at a time: the
+//observation bytes, the rewards and dones read through the wrapped addresses, and the cycle count,
+//which only matches when every environment is stepped exactly once
+//hashes the observations, rewards and dones after every checkpoint step and the last one
+static void
+run_env(struct regress_case *c, enum chip8_dispatch dispatch) {
+    const struct builtin *rom = find_builtin(c->rom + 4);
+    struct chip8_env_config config;
+    struct chip8_env *env = NULL;
+    struct chip8 *reference[ENV_LANES] = {NULL}, *machine;
+    uint8_t expected[CHIP8_ENV_OBS_HIRES_SIZE];
+    uint16_t actions[ENV_LANES];
+    unsigned int step, frame, l, count = 0, events;
+    const uint8_t *obs;
+    uint32_t scores[ENV_LANES], points;
+    bool hires, done[ENV_LANES] = {false};
+    size_t obs_size;
+    uint64_t h;
+    int keys[ENV_LANES];
+
+    if (rom == NULL) {
+        return;
+    }
+
+    memset(&config, 0, sizeof(config));
+    config.rom = rom->rom;
+    config.rom_size = rom->size;
+    config.profile = c->profile;
+    config.cycles_per_frame = c->cycles;
+    config.reward_addr = ENV_REWARD_ADDR;
+    config.reward_size = 2;
+    config.done_enabled = true;
+    config.done_addr = ENV_DONE_ADDR;
+    config.done_value = ENV_DONE_VALUE;
+    config.seed = 1;
+    config.threads = ENV_THREADS;
+
+    env = chip8_env_create(ENV_LANES, &config);
+    if (env == NULL) {
+        return;
+    }
+
+    for (l = 0; l < ENV_LANES; l++) {
+        chip8_set_dispatch(chip8_env_machine(env, l), dispatch);
+
+        reference[l] = chip8_create();
+        if (reference[l] == NULL) {
+            goto out;
+        }
+
+        chip8_set_profile(reference[l], c->profile);
+        chip8_seed(reference[l], config.seed + l);
+        chip8_load_mem(reference[l], rom->rom, rom->size);
+        scores[l] = env_score(reference[l]);
+    }
+
+    chip8_env_reset(env);
+    hires = chip8_profile_quirks(c->profile)->schip;
+    obs_size = chip8_env_obs_size(env);
+
+    for (step = 1; step <= c->frames; step++) {
+        //three movie frames a step, so the keys change every few steps
+        for (l = 0; l < ENV_LANES; l++) {
+            keys[l] = movie_key((step + l * 7) * 3);
+            actions[l] = keys[l] >= 0 ? 1 << keys[l] : 0;
+        }
+
+        chip8_env_step(env, actions, ENV_FRAMESKIP);
+
+        for (l = 0; l < ENV_LANES; l++) {
+            machine = reference[l];
+            if (done[l]) {
+                chip8_reset(machine);
+                scores[l] = env_score(machine);
+                done[l] = false;
+            }
+
+            memset(machine->key, 0, sizeof(machine->key));
+            if (keys[l] >= 0) {
+                machine->key[keys[l]] = 1;
+            }
+
+            for (frame = 0; frame < ENV_FRAMESKIP && !done[l]; frame++) {
+                events = chip8_run_cycles(machine, c->cycles);
+                chip8_tick_timers(machine);
+                done[l] = (events & (CHIP8_EVENT_UNHANDLED | CHIP8_EVENT_EXIT)) != 0 ||
+                          machine->memory[ENV_DONE_ADDR % machine->memory_size] == ENV_DONE_VALUE;
+            }
+
+            points = env_score(machine);
+            env_expected_obs(machine, hires, expected, obs_size);
+            obs = chip8_env_observations(env) + l * obs_size;
+
+            if (chip8_env_machine(env, l)->cycles != machine->cycles) {
+                snprintf(c->failure[dispatch], sizeof(c->failure[dispatch]),
+                         "env %u ran %llu instructions instead of %llu at step %u", l,
+                         (unsigned long long)chip8_env_machine(env, l)->cycles, (unsigned long long)machine->cycles, step);
+            }
+            else if (memcmp(obs, expected, obs_size) != 0) {
+                snprintf(c->failure[dispatch], sizeof(c->failure[dispatch]), "env %u observation differs at step %u", l, step);
+            }
+            else if (chip8_env_rewards(env)[l] != (float)((int64_t)points - (int64_t)scores[l])) {
+                snprintf(c->failure[dispatch], sizeof(c->failure[dispatch]), "env %u reward is %g instead of %lld at step %u",
+                         l, chip8_env_rewards(env)[l], (long long)points - (long long)scores[l], step);
+            }
+            else if (chip8_env_dones(env)[l] != done[l]) {
+                snprintf(c->failure[dispatch], sizeof(c->failure[dispatch]), "env %u done is %u instead of %u at step %u",
+                         l, chip8_env_dones(env)[l], done[l], step);
+            }
+
+            if (c->failure[dispatch][0] != '\0') {
+                goto out;
+            }
+
+            scores[l] = points;
+        }
+
+        if ((step % c->every == 0 || step == c->frames) && count < MAX_CHECKPOINTS) {
+            h = chip8_rom_hash(chip8_env_observations(env), ENV_LANES * obs_size);
+            h = h * 31 + chip8_rom_hash((const unsigned char *)chip8_env_rewards(env), ENV_LANES * sizeof(float));
+            h = h * 31 + chip8_rom_hash(chip8_env_dones(env), ENV_LANES);
+            c->actual[dispatch][count++] = h;
+        }
+    }
+
+    if (dispatch == CHIP8_DISPATCH_SWITCH) {
+        c->actual_count = count;
+        c->loaded = true;
+    }
+
+out:
+    for (l = 0; l < ENV_LANES; l++) {
+        chip8_destroy(reference[l]);
+    }
+    chip8_env_destroy(env);
+}
+
+//runs a case from power-on, hashing the state after every checkpoint frame and the last one
+static void
+run(struct chip8 *chip8, struct regress_case *c, enum chip8_dispatch dispatch) {
+    unsigned int frame, count = 0, events;
+    bool halted = false;
+
+    if (strncmp(c->rom, "env:", 4) == 0) {
+        run_env(c, dispatch);
+        return;
+    }
+
+    chip8_set_profile(chip8, c->profile);
+    chip8_set_dispatch(chip8, dispatch);
+    chip8_seed(chip8, 1);
+    memset(chip8->flags, 0, sizeof(chip8->flags));
+
+    if (!load(chip8, c->rom)) {
+        return;
+    }
+
+    for (frame = 1; frame <= c->frames; frame++) {
+        play_movie(chip8, frame - 1);
+
+        //a halted machine stays as it stopped, so the remaining checkpoints still compare
+        if (!halted) {
+            events = chip8_run_cycles(chip8, c->cycles);
+            halted = (events & (CHIP8_EVENT_UNHANDLED | CHIP8_EVENT_EXIT)) != 0;
+            chip8_tick_timers(chip8);
+        }
+
+        if ((frame % c->every == 0 || frame == c->frames) && count < MAX_CHECKPOINTS) {
+            c->actual[dispatch][count++] = hash_state(chip8);
+        }
+    }
+
+    //every strategy stops at the same frames, the switch gets to say how many
+    if (dispatch == CHIP8_DISPATCH_SWITCH) {
+        c->actual_count = count;
+        c->loaded = true;
+    }
+}
+
+static void *
+worker(void *arg) {
+    struct chip8 *chip8;
+    unsigned int job;
+    enum chip8_dispatch dispatch;
+
+    chip8 = chip8_create();
+    if (chip8 == NULL) {
+        return NULL;
+    }
+
+    //every case is run once per dispatch strategy, and every run is a job of its own
+    while (true) {
+        pthread_mutex_lock(&job_lock);
+        job = next_job++;
+        pthread_mutex_unlock(&job_lock);
+
+        if (job >= cases_count * CHIP8_DISPATCH_COUNT) {
+            break;
+        }
+
+        dispatch = job % CHIP8_DISPATCH_COUNT;
+        run(chip8, &cases[job / CHIP8_DISPATCH_COUNT], dispatch);
+    }
+
+    chip8_destroy(chip8);
+
+    return NULL;
+}
+
+//a case line is: <rom> <profile> <frames> <instructions per frame> <checkpoint every n frames> [hash]...
+//ROM names starting with builtin: are the test programs built into the suite
+static bool
+parse_case(struct regress_case *c, const char *line) {
+    char profile[64];
+    int offset;
+    const char *p;
+    unsigned long long hash;
+
+    memset(c, 0, sizeof(*c));
+
+    if (sscanf(line, "%255s %63s %u %u %u%n", c->rom, profile, &c->frames, &c->cycles, &c->every, &offset) != 5 ||
+        !chip8_profile_find(profile, &c->profile) || c->frames == 0 || c->every == 0) {
+        return false;
+    }
+
+    p = line + offset;
+    while (c->golden_count < MAX_CHECKPOINTS && sscanf(p, "%llx%n", &hash, &offset) == 1) {
+        c->golden[c->golden_count++] = hash;
+        p += offset;
+    }
+
+    return true;
+}
+
+//rewrites the golden file with the hashes just computed, keeping its comments and order
+static bool
+update(const char *path, char **lines, unsigned int lines_count, const int *line_case) {
+    char tmp[MAX_LINE + 8];
+    struct regress_case *c;
+    unsigned int i, k;
+    bool success;
+    FILE *f;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+    f = fopen(tmp, "w");
+    if (f == NULL) {
+        return false;
+    }
+
+    for (i = 0; i < lines_count; i++) {
+        if (line_case[i] < 0) {
+            fprintf(f, "%s\n", lines[i]);
+            continue;
+        }
+
+        c = &cases[line_case[i]];
+        if (!c->loaded) {
+            printf("%s: could not load, its hashes are left empty\n", c->rom);
+        }
+
+        fprintf(f, "%s %s %u %u %u", c->rom, chip8_profile_name(c->profile), c->frames, c->cycles, c->every);
+        for (k = 0; k < c->actual_count; k++) {
+            fprintf(f, " %016llX", (unsigned long long)c->actual[CHIP8_DISPATCH_SWITCH][k]);
+        }
+        fprintf(f, "\n");
+    }
+
+    success = fclose(f) == 0;
+    if (success) {
+        success = rename(tmp, path) == 0;
+    }
+
+    if (!success) {
+        unlink(tmp);
+    }
+
+    return success;
+}
+
+//checks one case, printing where it first went wrong
+static bool
+check(const struct regress_case *c) {
+    unsigned int d, k;
+
+    for (d = 0; d < CHIP8_DISPATCH_COUNT; d++) {
+        if (c->failure[d][0] != '\0') {
+            printf("FAIL %s (%s): %s dispatch %s\n", c->rom, chip8_profile_name(c->profile), chip8_dispatch_name(d), c->failure[d]);
+            return false;
+        }
+    }
+
+    if (!c->loaded) {
+        printf("FAIL %s (%s): could not load\n", c->rom, chip8_profile_name(c->profile));
+        return false;
+    }
+
+    if (c->golden_count != c->actual_count) {
+        printf("FAIL %s (%s): %u golden hashes for %u checkpoints, rerun with -u\n",
+               c->rom, chip8_profile_name(c->profile), c->golden_count, c->actual_count);
+        return false;
+    }
+
+    for (d = 0; d < CHIP8_DISPATCH_COUNT; d++) {
+        for (k = 0; k < c->actual_count; k++) {
+            if (c->actual[d][k] != c->golden[k]) {
+                printf("FAIL %s (%s): %s dispatch differs at frame %u, %016llX instead of %016llX\n",
+                       c->rom, chip8_profile_name(c->profile), chip8_dispatch_name(d),
+                       k + 1 < c->actual_count ? (k + 1) * c->every : c->frames,
+                       (unsigned long long)c->actual[d][k], (unsigned long long)c->golden[k]);
+                return false;
+            }
+        }
+    }
+
+    if (opt_verbose) {
+        printf("ok   %s (%s)\n", c->rom, chip8_profile_name(c->profile));
+    }
+
+    return true;
+}
+
+static void
+usage(const char *fmt, ...) {
+    va_list ap;
+
+    if (fmt != NULL) {
+        va_start(ap, fmt);
+        vprintf(fmt, ap);
+        va_end(ap);
+
+        fputc('\n', stdout);
+    }
+
+    puts("Usage: chip8regress [options] <golden file>");
+    puts("Runs every case in the golden file under a scripted input movie with each dispatch strategy");
+    puts("and compares the state at every checkpoint with the stored hashes. ROMs are looked up next to");
+    puts("the golden file.");
+    puts("Options:");
+    puts(" -t <threads> Worker threads. The default is one per core.");
+    puts(" -u           Write the hashes the switch interpreter gives back to the golden file.");
+    puts(" -v           List the passing cases too.");
+}
+
+int
+main(int argc, char **argv) {
+    static char *lines[MAX_CASES * 2];
+    static int line_case[MAX_CASES * 2];
+    pthread_t threads[256];
+    char buf[MAX_LINE], *slash;
+    const char *path;
+    unsigned int lines_count = 0, failed = 0, i;
+    uint64_t start;
+    size_t len;
+    FILE *f;
+    int arg;
+
+    opt_threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    for (arg = 1; arg < argc; arg++) {
+        if (strcmp(argv[arg], "-t") == 0 && arg + 1 < argc) {
+            opt_threads = atoi(argv[++arg]);
+        }
+        else if (strcmp(argv[arg], "-u") == 0) {
+            opt_update = true;
+        }
+        else if (strcmp(argv[arg], "-v") == 0) {
+            opt_verbose = true;
+        }
+        else {
+            break;
+        }
+    }
+
+    if (arg + 1 != argc) {
+        usage("No golden file given");
+        return 1;
+    }
+
+    if (opt_threads == 0) {
+        opt_threads = 1;
+    }
+    else if (opt_threads > sizeof(threads) / sizeof(*threads)) {
+        opt_threads = sizeof(threads) / sizeof(*threads);
+    }
+
+    path = argv[arg];
+    snprintf(rom_dir, sizeof(rom_dir), "%s", path);
+    slash = strrchr(rom_dir, '/');
+    if (slash != NULL) {
+        *slash = '\0';
+    }
+    else {
+        strcpy(rom_dir, ".");
+    }
+
+    f = fopen(path, "r");
+    if (f == NULL) {
+        usage("Could not open %s", path);
+        return 1;
+    }
+
+    while (fgets(buf, sizeof(buf), f) != NULL && lines_count < sizeof(lines) / sizeof(*lines)) {
+        len = strlen(buf);
+        while (len > 0 && (buf[len - 1] == '\n' || buf[len - 1] == '\r')) {
+            buf[--len] = '\0';
+        }
+
+        lines[lines_count] = strdup(buf);
+        line_case[lines_count] = -1;
+
+        if (buf[0] != '\0' && buf[0] != '#') {
+            if (cases_count == MAX_CASES || !parse_case(&cases[cases_count], buf)) {
+                printf("%s:%u: invalid case\n", path, lines_count + 1);
+                fclose(f);
+                return 1;
+            }
+
+            line_case[lines_count] = cases_count++;
+        }
+
+        ++lines_count;
+    }
+
+    fclose(f);
+
+    start = time_ns();
+
+    for (i = 0; i < opt_threads; i++) {
+        pthread_create(&threads[i], NULL, worker, NULL);
+    }
+
+    for (i = 0; i < opt_threads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    if (opt_update) {
+        if (!update(path, lines, lines_count, line_case)) {
+            printf("Could not write %s\n", path);
+            return 1;
+        }
+
+        printf("Updated %u cases in %s\n", cases_count, path);
+    }
+    else {
+        for (i = 0; i < cases_count; i++) {
+            if (!check(&cases[i])) {
+                ++failed;
+            }
+        }
+
+        printf("%u of %u cases passed in %.2f seconds\n", cases_count - failed, cases_count,
+               (time_ns() - start) / 1e9);
+    }
+
+    for (i = 0; i < lines_count; i++) {
+        free(lines[i]);
+    }
+
+    return failed > 0 ? 1 : 0;
+}
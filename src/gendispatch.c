@@ -0,0 +1,649 @@
+//generates chip8dispatch.inc, the handlers for every opcode with its register operands baked in,
+//an array of them and a 65,536 entry table mapping every opcode to its handler's index
+//the output is included by chip8profile.inc once per quirk profile, so handlers are named
+//through PROFILE_NAME() and quirk dependent code is left as #if QUIRK_* blocks; the index table
+//is the same for every profile, so only the first include defines it
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+//writes tmpl to stdout with @X and @Y replaced by the register numbers
+static void
+emit(const char *tmpl, int x, int y) {
+    const char *p;
+
+    for (p = tmpl; *p != '\0'; p++) {
+        if (p[0] == '@' && p[1] == 'X') {
+            printf("%d", x);
+            p++;
+        }
+        else if (p[0] == '@' && p[1] == 'Y') {
+            printf("%d", y);
+            p++;
+        }
+        else {
+            putchar(*p);
+        }
+    }
+}
+
+//writes the handler's name, suffixed with its register operands
+static void
+emit_name(const char *name, int x, int y) {
+    printf("PROFILE_NAME(%s", name);
+    if (x >= 0) {
+        printf("_%X", x);
+    }
+    if (y >= 0) {
+        printf("_%X", y);
+    }
+    printf(")");
+}
+
+static void
+emit_handler(const char *name, const char *body, int x, int y) {
+    printf("static bool\n");
+    emit_name(name, x, y);
+    printf("(struct chip8 *chip8, uint16_t opcode, unsigned int *events) {\n");
+    emit(body, x, y);
+    printf("    return true;\n}\n\n");
+}
+
+struct op {
+    const char *name;
+    const char *body;
+};
+
+//handlers taking no register operands
+static const struct op ops_none[] = {
+    {"nop",
+        "    //0000: Ignored, the program counter doesn't move\n"},
+    {"cls",
+        "    //00E0: Clear the screen\n"
+        "    chip8_gfx_clear(chip8, chip8->planes);\n"
+        "    *events |= CHIP8_EVENT_FRAME;\n"
+        "    chip8->pc += 2;\n"},
+    {"ret",
+        "    //00EE: Return from a subroutine\n"
+        "    if (chip8->sp == 0) {\n"
+        "        chip8_log(chip8, \"Stack underflow at 0x%04X\", chip8->pc);\n"
+        "        *events |= CHIP8_EVENT_UNHANDLED;\n"
+        "        return false;\n"
+        "    }\n"
+        "\n"
+        "    chip8->pc = chip8->stack[--chip8->sp] + 2;\n"},
+    {"scr",
+        "#if QUIRK_SCHIP\n"
+        "    //00FB: Scroll the display right by 4 pixels\n"
+        "    chip8_gfx_scroll_horizontal(chip8, 4);\n"
+        "    *events |= CHIP8_EVENT_FRAME;\n"
+        "    chip8->pc += 2;\n"
+        "#else\n"
+        "    return PROFILE_NAME(trap)(chip8, opcode, events);\n"
+        "#endif\n"},
+    {"scl",
+        "#if QUIRK_SCHIP\n"
+        "    //00FC: Scroll the display left by 4 pixels\n"
+        "    chip8_gfx_scroll_horizontal(chip8, -4);\n"
+        "    *events |= CHIP8_EVENT_FRAME;\n"
+        "    chip8->pc += 2;\n"
+        "#else\n"
+        "    return PROFILE_NAME(trap)(chip8, opcode, events);\n"
+        "#endif\n"},
+    {"exit",
+        "#if QUIRK_SCHIP\n"
+        "    //00FD: Exit the interpreter\n"
+        "    *events |= CHIP8_EVENT_EXIT;\n"
+        "    return false;\n"
+        "#else\n"
+        "    return PROFILE_NAME(trap)(chip8, opcode, events);\n"
+        "#endif\n"},
+    {"low",
+        "#if QUIRK_SCHIP\n"
+        "    //00FE: Switch to the 64x32 display\n"
+        "    chip8_gfx_resize(chip8, false);\n"
+        "    *events |= CHIP8_EVENT_FRAME;\n"
+        "    chip8->pc += 2;\n"
+        "#else\n"
+        "    return PROFILE_NAME(trap)(chip8, opcode, events);\n"
+        "#endif\n"},
+    {"high",
+        "#if QUIRK_SCHIP\n"
+        "    //00FF: Switch to the 128x64 display\n"
+        "    chip8_gfx_resize(chip8, true);\n"
+        "    *events |= CHIP8_EVENT_FRAME;\n"
+        "    chip8->pc += 2;\n"
+        "#else\n"
+        "    return PROFILE_NAME(trap)(chip8, opcode, events);\n"
+        "#endif\n"},
+    {"scd",
+        "#if QUIRK_SCHIP\n"
+        "    //00CN: Scroll the display down by N pixels\n"
+        "    chip8_gfx_scroll_vertical(chip8, opcode & 0x000F);\n"
+        "    *events |= CHIP8_EVENT_FRAME;\n"
+        "    chip8->pc += 2;\n"
+        "#else\n"
+        "    return PROFILE_NAME(trap)(chip8, opcode, events);\n"
+        "#endif\n"},
+    {"scu",
+        "#if QUIRK_XOCHIP\n"
+        "    //00DN: Scroll the display up by N pixels\n"
+        "    chip8_gfx_scroll_vertical(chip8, -(opcode & 0x000F));\n"
+        "    *events |= CHIP8_EVENT_FRAME;\n"
+        "    chip8->pc += 2;\n"
+        "#else\n"
+        "    return PROFILE_NAME(trap)(chip8, opcode, events);\n"
+        "#endif\n"},
+    {"jp",
+        "    //1NNN: Jump to address NNN\n"
+        "    chip8->pc = opcode & 0x0FFF;\n"},
+    {"call",
+        "    //2NNN: Execute subroutine starting at address NNN\n"
+        "    if (chip8->sp == CHIP8_STACK_DEPTH) {\n"
+        "        chip8_log(chip8, \"Stack overflow at 0x%04X\", chip8->pc);\n"
+        "        *events |= CHIP8_EVENT_UNHANDLED;\n"
+        "        return false;\n"
+        "    }\n"
+        "\n"
+        "    chip8->stack[chip8->sp++] = chip8->pc;\n"
+        "    chip8->pc = opcode & 0x0FFF;\n"},
+    {"ld_i",
+        "    //ANNN: Sets I to the address NNN\n"
+        "    chip8->I = opcode & 0x0FFF;\n"
+        "    chip8->pc += 2;\n"},
+    {"ld_i_long",
+        "#if QUIRK_XOCHIP\n"
+        "    //F000 NNNN: Sets I to the 16 bit address NNNN in the next two bytes\n"
+        "    chip8->I = chip8->memory[(uint16_t)(chip8->pc + 2)] << 8 | chip8->memory[(uint16_t)(chip8->pc + 3)];\n"
+        "    chip8->pc += 4;\n"
+        "#else\n"
+        "    return PROFILE_NAME(trap)(chip8, opcode, events);\n"
+        "#endif\n"},
+    {"audio",
+        "#if QUIRK_XOCHIP\n"
+        "    //F002: Loads the 16 byte audio pattern starting at I\n"
+        "    int i;\n"
+        "\n"
+        "    for (i = 0; i < 16; i++) {\n"
+        "        chip8->audio_pattern[i] = chip8->memory[ADDR(chip8, chip8->I + i)];\n"
+        "    }\n"
+        "\n"
+        "    chip8->pc += 2;\n"
+        "#else\n"
+        "    return PROFILE_NAME(trap)(chip8, opcode, events);\n"
+        "#endif\n"},
+    {NULL, NULL}
+};
+
+//handlers taking X
+static const struct op ops_x[] = {
+    {"se_nn",
+        "    //3XNN: Skip the following instruction if V[X] equals NN\n"
+        "    PROFILE_NAME(skip)(chip8, chip8->V[@X] == (opcode & 0x00FF));\n"},
+    {"sne_nn",
+        "    //4XNN: Skip the following instruction if V[X] is not equal to NN\n"
+        "    PROFILE_NAME(skip)(chip8, chip8->V[@X] != (opcode & 0x00FF));\n"},
+    {"ld_nn",
+        "    //6XNN: Sets V[X] to NN\n"
+        "    chip8->V[@X] = opcode & 0x00FF;\n"
+        "    chip8->pc += 2;\n"},
+    {"add_nn",
+        "    //7XNN: Adds NN to V[X]\n"
+        "    chip8->V[@X] += opcode & 0x00FF;\n"
+        "    chip8->pc += 2;\n"},
+    {"jp_v",
+        "#if QUIRK_JUMP_VX\n"
+        "    //BXNN: Jumps to XNN + V[X]\n"
+        "    chip8->pc = (opcode & 0x0FFF) + chip8->V[@X];\n"
+        "#else\n"
+        "    //BNNN: Jumps to NNN + V0\n"
+        "    chip8->pc = (opcode & 0x0FFF) + chip8->V[0];\n"
+        "#endif\n"},
+    {"rnd",
+        "    //CXNN: Sets V[X] to a random number masked by NN\n"
+        "    chip8->V[@X] = chip8_rand(chip8) & (opcode & 0x00FF);\n"
+        "    chip8->pc += 2;\n"},
+    {"skp",
+        "    //EX9E: Skips the next instruction if the key stored in V[X] is pressed\n"
+        "    PROFILE_NAME(skip)(chip8, chip8->key[chip8->V[@X] & 0xF] != 0);\n"},
+    {"sknp",
+        "    //EXA1: Skips the next instruction if the key stored in V[X] is not pressed\n"
+        "    PROFILE_NAME(skip)(chip8, chip8->key[chip8->V[@X] & 0xF] == 0);\n"},
+    {"plane",
+        "#if QUIRK_XOCHIP\n"
+        "    //FN01: Selects the bitplanes N to draw to, clear and scroll\n"
+        "    chip8->planes = @X & 0x3;\n"
+        "    chip8->pc += 2;\n"
+        "#else\n"
+        "    return PROFILE_NAME(trap)(chip8, opcode, events);\n"
+        "#endif\n"},
+    {"ld_dt",
+        "    //FX07: Sets V[X] to the value of the delay timer\n"
+        "    chip8->V[@X] = chip8->dt;\n"
+        "    chip8->pc += 2;\n"},
+    {"ld_k",
+        "    //FX0A: Key press awaited, stored in V[X]\n"
+        "    int i;\n"
+        "\n"
+        "    for (i = 0; i < 16; i++) {\n"
+        "        if (chip8->key[i] != 0) {\n"
+        "            chip8->V[@X] = i;\n"
+        "            chip8->pc += 2;\n"
+        "            return true;\n"
+        "        }\n"
+        "    }\n"
+        "\n"
+        "    *events |= CHIP8_EVENT_KEY_WAIT;\n"},
+    {"set_dt",
+        "    //FX15: Sets the delay timer to V[X]\n"
+        "    chip8->dt = chip8->V[@X];\n"
+        "    chip8->pc += 2;\n"},
+    {"set_st",
+        "    //FX18: Sets the sound timer to V[X]\n"
+        "    if (chip8->st == 0 && chip8->V[@X] != 0) {\n"
+        "        *events |= CHIP8_EVENT_SOUND_ON;\n"
+        "        chip8->sound_on_cycle = chip8->cycles + 1;\n"
+        "    }\n"
+        "    else if (chip8->st != 0 && chip8->V[@X] == 0) {\n"
+        "        chip8->sound_off_cycle = chip8->cycles + 1;\n"
+        "    }\n"
+        "\n"
+        "    chip8->st = chip8->V[@X];\n"
+        "    chip8->pc += 2;\n"},
+    {"add_i",
+        "    //FX1E: V[X] is added to I, then with the ADD_I_VF quirk V[F] is set to 1 when there was an overflow, otherwise 0\n"
+        "#if QUIRK_ADD_I_VF\n"
+        "    uint8_t flag = chip8->I + chip8->V[@X] > 0xFFF;\n"
+        "\n"
+        "    chip8->I += chip8->V[@X];\n"
+        "    chip8->V[0xF] = flag;\n"
+        "#else\n"
+        "    chip8->I += chip8->V[@X];\n"
+        "#endif\n"
+        "    chip8->pc += 2;\n"},
+    {"ld_f",
+        "    //FX29: Sets I to the location of the font sprite for the character in V[X]\n"
+        "    chip8->I = chip8->V[@X] * 0x5;\n"
+        "    chip8->pc += 2;\n"},
+    {"ld_hf",
+        "#if QUIRK_SCHIP\n"
+        "    //FX30: Sets I to the location of the big 8x10 font sprite for the character in V[X]\n"
+        "    chip8->I = BIG_FONT_START + (chip8->V[@X] & 0xF) * 10;\n"
+        "    chip8->pc += 2;\n"
+        "#else\n"
+        "    return PROFILE_NAME(trap)(chip8, opcode, events);\n"
+        "#endif\n"},
+    {"pitch",
+        "#if QUIRK_XOCHIP\n"
+        "    //FX3A: Sets the audio pattern's playback pitch to V[X]\n"
+        "    chip8->pitch = chip8->V[@X];\n"
+        "    chip8->pc += 2;\n"
+        "#else\n"
+        "    return PROFILE_NAME(trap)(chip8, opcode, events);\n"
+        "#endif\n"},
+    {"st_flags",
+        "#if QUIRK_SCHIP\n"
+        "    //FX75: Stores V[0] - V[X] in the RPL user flags\n"
+        "    memcpy(chip8->flags, chip8->V, @X + 1);\n"
+        "    chip8->pc += 2;\n"
+        "#else\n"
+        "    return PROFILE_NAME(trap)(chip8, opcode, events);\n"
+        "#endif\n"},
+    {"ld_flags",
+        "#if QUIRK_SCHIP\n"
+        "    //FX85: Fills V[0] - V[X] from the RPL user flags\n"
+        "    memcpy(chip8->V, chip8->flags, @X + 1);\n"
+        "    chip8->pc += 2;\n"
+        "#else\n"
+        "    return PROFILE_NAME(trap)(chip8, opcode, events);\n"
+        "#endif\n"},
+    {"ld_b",
+        "    //FX33: Stores the binary encoded decimal representation of V[X] at I, I+1, I+2\n"
+        "    chip8->memory[ADDR(chip8, chip8->I)] = chip8->V[@X] / 100;\n"
+        "    chip8->memory[ADDR(chip8, chip8->I + 1)] = (chip8->V[@X] / 10) % 10;\n"
+        "    chip8->memory[ADDR(chip8, chip8->I + 2)] = chip8->V[@X] % 10;\n"
+        "    chip8->pc += 2;\n"},
+    {"st_regs",
+        "    //FX55: Stores V[0] - V[X] in memory starting at address I\n"
+        "    int i;\n"
+        "\n"
+        "    for (i = 0; i <= @X; i++) {\n"
+        "        chip8->memory[ADDR(chip8, chip8->I + i)] = chip8->V[i];\n"
+        "    }\n"
+        "#if QUIRK_LOAD_STORE_INC_I\n"
+        "    chip8->I += @X + 1;\n"
+        "#endif\n"
+        "    chip8->pc += 2;\n"},
+    {"ld_regs",
+        "    //FX65: Fills V[0] - V[X] from memory starting at address I\n"
+        "    int i;\n"
+        "\n"
+        "    for (i = 0; i <= @X; i++) {\n"
+        "        chip8->V[i] = chip8->memory[ADDR(chip8, chip8->I + i)];\n"
+        "    }\n"
+        "#if QUIRK_LOAD_STORE_INC_I\n"
+        "    chip8->I += @X + 1;\n"
+        "#endif\n"
+        "    chip8->pc += 2;\n"},
+    {NULL, NULL}
+};
+
+//handlers taking X and Y
+static const struct op ops_xy[] = {
+    {"se",
+        "    //5XY0: Skip the following instruction if V[X] equals V[Y]\n"
+        "    PROFILE_NAME(skip)(chip8, chip8->V[@X] == chip8->V[@Y]);\n"},
+    {"st_range",
+        "#if QUIRK_XOCHIP\n"
+        "    //5XY2: Stores V[X] - V[Y] in memory starting at I\n"
+        "    PROFILE_NAME(copy_range)(chip8, @X, @Y, true);\n"
+        "    chip8->pc += 2;\n"
+        "#else\n"
+        "    //5XY0: Skip the following instruction if V[X] equals V[Y]\n"
+        "    PROFILE_NAME(skip)(chip8, chip8->V[@X] == chip8->V[@Y]);\n"
+        "#endif\n"},
+    {"ld_range",
+        "#if QUIRK_XOCHIP\n"
+        "    //5XY3: Fills V[X] - V[Y] from memory starting at I\n"
+        "    PROFILE_NAME(copy_range)(chip8, @X, @Y, false);\n"
+        "    chip8->pc += 2;\n"
+        "#else\n"
+        "    //5XY0: Skip the following instruction if V[X] equals V[Y]\n"
+        "    PROFILE_NAME(skip)(chip8, chip8->V[@X] == chip8->V[@Y]);\n"
+        "#endif\n"},
+    {"sne",
+        "    //9XY0: Skip the following instruction if V[X] is not equal to V[Y]\n"
+        "    PROFILE_NAME(skip)(chip8, chip8->V[@X] != chip8->V[@Y]);\n"},
+    {"ld",
+        "    //8XY0: Sets V[X] to the value of V[Y]\n"
+        "    chip8->V[@X] = chip8->V[@Y];\n"
+        "    chip8->pc += 2;\n"},
+    {"or",
+        "    //8XY1: Sets V[X] to (V[X] OR V[Y])\n"
+        "    chip8->V[@X] |= chip8->V[@Y];\n"
+        "#if QUIRK_VF_RESET\n"
+        "    chip8->V[0xF] = 0;\n"
+        "#endif\n"
+        "    chip8->pc += 2;\n"},
+    {"and",
+        "    //8XY2: Sets V[X] to (V[X] AND V[Y])\n"
+        "    chip8->V[@X] &= chip8->V[@Y];\n"
+        "#if QUIRK_VF_RESET\n"
+        "    chip8->V[0xF] = 0;\n"
+        "#endif\n"
+        "    chip8->pc += 2;\n"},
+    {"xor",
+        "    //8XY3: Sets V[X] to (V[X] XOR V[Y])\n"
+        "    chip8->V[@X] ^= chip8->V[@Y];\n"
+        "#if QUIRK_VF_RESET\n"
+        "    chip8->V[0xF] = 0;\n"
+        "#endif\n"
+        "    chip8->pc += 2;\n"},
+    {"add",
+        "    //8XY4: Adds V[Y] to V[X], then V[F] is set to the carry\n"
+        "    uint8_t flag = chip8->V[@X] + chip8->V[@Y] > 0xFF;\n"
+        "\n"
+        "    chip8->V[@X] += chip8->V[@Y];\n"
+        "    chip8->V[0xF] = flag;\n"
+        "    chip8->pc += 2;\n"},
+    {"sub",
+        "    //8XY5: V[Y] is subtracted from V[X], then V[F] is set to 0 when there was a borrow\n"
+        "    uint8_t flag = chip8->V[@X] >= chip8->V[@Y];\n"
+        "\n"
+        "    chip8->V[@X] -= chip8->V[@Y];\n"
+        "    chip8->V[0xF] = flag;\n"
+        "    chip8->pc += 2;\n"},
+    {"shr",
+        "    //8XY6: V[X] is shifted right by one, then V[F] is set to the bit shifted out\n"
+        "    uint8_t flag;\n"
+        "\n"
+        "#if QUIRK_SHIFT_VY\n"
+        "    chip8->V[@X] = chip8->V[@Y];\n"
+        "#endif\n"
+        "    flag = chip8->V[@X] & 0x1;\n"
+        "    chip8->V[@X] >>= 1;\n"
+        "    chip8->V[0xF] = flag;\n"
+        "    chip8->pc += 2;\n"},
+    {"subn",
+        "    //8XY7: V[X] is set to V[Y] minus V[X], then V[F] is set to 0 when there was a borrow\n"
+        "    uint8_t flag = chip8->V[@Y] >= chip8->V[@X];\n"
+        "\n"
+        "    chip8->V[@X] = chip8->V[@Y] - chip8->V[@X];\n"
+        "    chip8->V[0xF] = flag;\n"
+        "    chip8->pc += 2;\n"},
+    {"shl",
+        "    //8XYE: V[X] is shifted left by one, then V[F] is set to the bit shifted out\n"
+        "    uint8_t flag;\n"
+        "\n"
+        "#if QUIRK_SHIFT_VY\n"
+        "    chip8->V[@X] = chip8->V[@Y];\n"
+        "#endif\n"
+        "    flag = chip8->V[@X] >> 7;\n"
+        "    chip8->V[@X] <<= 1;\n"
+        "    chip8->V[0xF] = flag;\n"
+        "    chip8->pc += 2;\n"},
+    {"drw",
+        "    //DXYN: Draws a sprite at coordinate (V[X],V[Y]) that has a width of 8 pixels and a height of N pixels\n"
+        "    PROFILE_NAME(draw)(chip8, chip8->V[@X], chip8->V[@Y], opcode & 0x000F);\n"
+        "    *events |= CHIP8_EVENT_FRAME;\n"
+        "    chip8->pc += 2;\n"},
+    {NULL, NULL}
+};
+
+static int
+count_ops(const struct op *ops) {
+    int n = 0;
+
+    while (ops[n].name != NULL) {
+        n++;
+    }
+
+    return n;
+}
+
+static int
+find_op(const struct op *ops, const char *name) {
+    int i;
+
+    for (i = 0; strcmp(ops[i].name, name) != 0; i++);
+
+    return i;
+}
+
+//the handler for opcode as an index into the array main() writes out: the trap, then ops_none,
+//then ops_x for every X and then ops_xy for every X and Y
+static unsigned int
+handler_index(uint16_t opcode) {
+    int x = (opcode & 0x0F00) >> 8;
+    int y = (opcode & 0x00F0) >> 4;
+    const char *op = NULL;
+    bool use_x = false, use_y = false;
+
+    switch (opcode & 0xF000) {
+        case 0x0000:
+            if ((opcode & 0x00FF) == 0x00E0) {
+                op = "cls";
+            }
+            else if ((opcode & 0x00FF) == 0x00EE) {
+                op = "ret";
+            }
+            else if ((opcode & 0x00FF) == 0x00FB) {
+                op = "scr";
+            }
+            else if ((opcode & 0x00FF) == 0x00FC) {
+                op = "scl";
+            }
+            else if ((opcode & 0x00FF) == 0x00FD) {
+                op = "exit";
+            }
+            else if ((opcode & 0x00FF) == 0x00FE) {
+                op = "low";
+            }
+            else if ((opcode & 0x00FF) == 0x00FF) {
+                op = "high";
+            }
+            else if ((opcode & 0x00F0) == 0x00C0) {
+                op = "scd";
+            }
+            else if ((opcode & 0x00F0) == 0x00D0) {
+                op = "scu";
+            }
+            else if (opcode == 0x0000) {
+                op = "nop";
+            }
+            break;
+        case 0x1000: op = "jp"; break;
+        case 0x2000: op = "call"; break;
+        case 0x3000: op = "se_nn"; use_x = true; break;
+        case 0x4000: op = "sne_nn"; use_x = true; break;
+        case 0x5000:
+            use_x = use_y = true;
+            switch (opcode & 0x000F) {
+                case 0x2: op = "st_range"; break;
+                case 0x3: op = "ld_range"; break;
+                default: op = "se"; break;
+            }
+            break;
+        case 0x6000: op = "ld_nn"; use_x = true; break;
+        case 0x7000: op = "add_nn"; use_x = true; break;
+        case 0x8000:
+            use_x = use_y = true;
+            switch (opcode & 0x000F) {
+                case 0x0: op = "ld"; break;
+                case 0x1: op = "or"; break;
+                case 0x2: op = "and"; break;
+                case 0x3: op = "xor"; break;
+                case 0x4: op = "add"; break;
+                case 0x5: op = "sub"; break;
+                case 0x6: op = "shr"; break;
+                case 0x7: op = "subn"; break;
+                case 0xE: op = "shl"; break;
+            }
+            break;
+        case 0x9000: op = "sne"; use_x = use_y = true; break;
+        case 0xA000: op = "ld_i"; break;
+        case 0xB000: op = "jp_v"; use_x = true; break;
+        case 0xC000: op = "rnd"; use_x = true; break;
+        case 0xD000: op = "drw"; use_x = use_y = true; break;
+        case 0xE000:
+            use_x = true;
+            switch (opcode & 0x00FF) {
+                case 0x9E: op = "skp"; break;
+                case 0xA1: op = "sknp"; break;
+            }
+            break;
+        case 0xF000:
+            if (opcode == 0xF000) {
+                op = "ld_i_long";
+                break;
+            }
+            if (opcode == 0xF002) {
+                op = "audio";
+                break;
+            }
+
+            use_x = true;
+            switch (opcode & 0x00FF) {
+                case 0x01: op = "plane"; break;
+                case 0x07: op = "ld_dt"; break;
+                case 0x0A: op = "ld_k"; break;
+                case 0x15: op = "set_dt"; break;
+                case 0x18: op = "set_st"; break;
+                case 0x1E: op = "add_i"; break;
+                case 0x29: op = "ld_f"; break;
+                case 0x30: op = "ld_hf"; break;
+                case 0x33: op = "ld_b"; break;
+                case 0x3A: op = "pitch"; break;
+                case 0x55: op = "st_regs"; break;
+                case 0x65: op = "ld_regs"; break;
+                case 0x75: op = "st_flags"; break;
+                case 0x85: op = "ld_flags"; break;
+            }
+            break;
+    }
+
+    if (op == NULL) {
+        return 0;
+    }
+    else if (use_y) {
+        return 1 + count_ops(ops_none) + count_ops(ops_x) * 16 + find_op(ops_xy, op) * 256 + x * 16 + y;
+    }
+    else if (use_x) {
+        return 1 + count_ops(ops_none) + find_op(ops_x, op) * 16 + x;
+    }
+    else {
+        return 1 + find_op(ops_none, op);
+    }
+}
+
+int
+main(int argc, char **argv) {
+    const struct op *op;
+    int x, y;
+    unsigned int opcode;
+
+    puts("//generated by gendispatch, do not edit");
+    puts("");
+
+    for (op = ops_none; op->name != NULL; op++) {
+        emit_handler(op->name, op->body, -1, -1);
+    }
+
+    for (op = ops_x; op->name != NULL; op++) {
+        for (x = 0; x < 16; x++) {
+            emit_handler(op->name, op->body, x, -1);
+        }
+    }
+
+    for (op = ops_xy; op->name != NULL; op++) {
+        for (x = 0; x < 16; x++) {
+            for (y = 0; y < 16; y++) {
+                emit_handler(op->name, op->body, x, y);
+            }
+        }
+    }
+
+    //each profile only needs its own few thousand handlers, in the order handler_index() counts them
+    puts("static bool (* const PROFILE_NAME(handlers)[])(struct chip8 *chip8, uint16_t opcode, unsigned int *events) = {");
+    printf("    PROFILE_NAME(trap),\n");
+    for (op = ops_none; op->name != NULL; op++) {
+        printf("    ");
+        emit_name(op->name, -1, -1);
+        printf(",\n");
+    }
+
+    for (op = ops_x; op->name != NULL; op++) {
+        for (x = 0; x < 16; x++) {
+            printf("%s", x % 4 == 0 ? "    " : "");
+            emit_name(op->name, x, -1);
+            printf(",%s", x % 4 == 3 ? "\n" : " ");
+        }
+    }
+
+    for (op = ops_xy; op->name != NULL; op++) {
+        for (x = 0; x < 16; x++) {
+            for (y = 0; y < 16; y++) {
+                printf("%s", y % 4 == 0 ? "    " : "");
+                emit_name(op->name, x, y);
+                printf(",%s", y % 4 == 3 ? "\n" : " ");
+            }
+        }
+    }
+    puts("};");
+    puts("");
+
+    //the opcode to handler mapping doesn't depend on the quirks, so one copy serves every profile
+    puts("#ifndef CHIP8_DISPATCH_INDEX");
+    puts("#define CHIP8_DISPATCH_INDEX");
+    puts("static const uint16_t chip8_dispatch_index[65536] = {");
+    for (opcode = 0; opcode < 65536; opcode++) {
+        printf("%s%u,%s", opcode % 16 == 0 ? "    " : "", handler_index(opcode), opcode % 16 == 15 ? "\n" : " ");
+    }
+    puts("};");
+    puts("#endif");
+
+    return 0;
+}
@@ -3,15 +3,18 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <string.h>
-#include <time.h>
-#include <errno.h>
+#include <limits.h>
 #include <time.h>
 #include <ncurses.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <signal.h>
+#include "chip8.h"
+#include "chip8audio.h"
+#include "chip8db.h"
 
-#define GFX_WIDTH  64
-#define GFX_HEIGHT 32
+#define GFX_WIDTH  CHIP8_GFX_WIDTH
+#define GFX_HEIGHT CHIP8_GFX_HEIGHT
 
 #define LOG_LINES_MAX 18
 #define LOG_LINE_LEN  GFX_WIDTH
@@ -19,53 +22,57 @@
 #define DEBUGGER_LINES_MAX ((GFX_HEIGHT) + 1 + 1 + (LOG_LINES_MAX))
 #define DEBUGGER_LINE_LEN  50
 
-//game window
-static WINDOW *win_game;
-
-//log window
-static WINDOW *win_log;
-
-//debugging window
-static WINDOW *win_debugger;
+//the timers count at 60Hz, so the CPU can't run slower than that
+#define FPS_MIN 60
 
-//thread to count down the delay timer and sound timer at 60Hz
-static pthread_t thread_timers;
+//how long a key stays down after the terminal reports it, terminals don't report releases
+#define KEY_HOLD_MS 100
 
-//thread to capture the keyboard
-static pthread_t thread_keys;
+//the ROM database used when -b isn't given, relative to $HOME
+#define DB_DEFAULT_NAME ".chip8db"
 
-//index register
-static uint16_t I;
+//keeps emulated time in step with the wall clock
+//time is counted in instruction slots, opt_fps of them per second, which pass whether the machine
+//runs an instruction in them or sits in FX0A; when the host stalls the emulator the missed slots are
+//run in batches of up to a 60th of a second, skipping renders in between, and if it falls further
+//behind than opt_max_lag the rest is given up so the game never runs visibly fast
+struct governor {
+    //wall time slot 0 started at, moved forward when time is given up
+    uint64_t start_us;
 
-//program counter
-static uint16_t pc;
+    //slots emulated and timer ticks done since start_us
+    uint64_t slots;
+    uint64_t ticks;
 
-//current opcode being processed
-static uint16_t opcode;
+    //renders skipped in a row while catching up
+    unsigned int skipped;
 
-//stack pointer
-static uint8_t sp;
+    //renders skipped and wall time given up altogether
+    uint64_t dropped_frames;
+    uint64_t dropped_ms;
 
-//delay timer and its lock
-static uint8_t dt;
-static pthread_rwlock_t dt_lock;
+    //how far behind the wall clock the last batch started, and the worst so far
+    uint64_t lag_ms;
+    uint64_t lag_max_ms;
+};
 
-//sound timer and its lock
-static uint8_t st;
-static pthread_rwlock_t st_lock;
+//game window
+static WINDOW *win_game;
 
-static unsigned char memory[4096];
+//log window
+static WINDOW *win_log;
 
-//15 CPU registers, with the 16th one used for the carry flag
-static unsigned char V[16];
+//debugging window
+static WINDOW *win_debugger;
 
-static uint16_t stack[16];
+//thread to capture the keyboard
+static pthread_t thread_keys;
 
-//represents what's currently being displayed
-static unsigned char gfx[GFX_WIDTH * GFX_HEIGHT];
+//the emulated machine
+static struct chip8 *chip8;
 
-//currently pressed keys
-static unsigned char key[16];
+//renders the sound timer when a WAV file or pipe was asked for, otherwise the terminal bell is used
+static struct chip8_audio *audio;
 
 //maps to
 // Keypad
@@ -85,25 +92,6 @@ static unsigned char key_map[16] = {
     'z', 'x', 'c', 'v'
 };
 
-static unsigned char font_set[] = {
-    0xF0, 0x90, 0x90, 0x90, 0xF0, //0
-    0x20, 0x60, 0x20, 0x20, 0x70, //1
-    0xF0, 0x10, 0xF0, 0x80, 0xF0, //2
-    0xF0, 0x10, 0xF0, 0x10, 0xF0, //3
-    0x90, 0x90, 0xF0, 0x10, 0x10, //4
-    0xF0, 0x80, 0xF0, 0x10, 0xF0, //5
-    0xF0, 0x80, 0xF0, 0x90, 0xF0, //6
-    0xF0, 0x10, 0x20, 0x40, 0x40, //7
-    0xF0, 0x90, 0xF0, 0x90, 0xF0, //8
-    0xF0, 0x90, 0xF0, 0x10, 0xF0, //9
-    0xF0, 0x90, 0xF0, 0x90, 0x90, //A
-    0xE0, 0x90, 0xE0, 0x90, 0xE0, //B
-    0xF0, 0x80, 0x80, 0x80, 0xF0, //C
-    0xE0, 0x90, 0x90, 0x90, 0xE0, //D
-    0xF0, 0x80, 0xF0, 0x80, 0xF0, //E
-    0xF0, 0x80, 0xF0, 0x80, 0x80  //F
-};
-
 static bool draw_game;
 static bool draw_log;
 
@@ -116,10 +104,52 @@ static bool debugger_stepping = false;
 static const char *opt_path = NULL;
 static int opt_fps = 120;
 static int opt_color = COLOR_GREEN;
+static enum chip8_profile opt_profile = CHIP8_PROFILE_DEFAULT;
+static enum chip8_dispatch opt_dispatch = CHIP8_DISPATCH_SWITCH;
+static const char *opt_wav = NULL;
+static const char *opt_pipe = NULL;
+static const char *opt_db = NULL;
+static const char *opt_keys = NULL;
+static bool opt_save = false;
+static bool opt_latency = false;
+static int opt_max_lag = 250;
+static int opt_max_skip = 4;
+static int opt_run_ahead = 0;
+
+//settings given on the command line win over the ROM database
+static bool opt_fps_set = false;
+static bool opt_profile_set = false;
 
 static uint64_t counter_frames;
 static time_t program_start;
 
+static struct governor governor;
+
+//with run-ahead the real machine is saved here while the frame to show is worked out
+static struct chip8_snapshot *run_ahead_snapshot;
+
+//input lag with -m: on every press the game is run on from that moment twice, a 60th of a second at a
+//time, once with the key going down for as long as handle_keyboard() holds it and once without; after
+//every tick both timelines' screens are compared as they are and as render() would show them, and the
+//first tick each pair differs at is the lag without and with run-ahead
+#define LATENCY_MAX_FRAMES 60
+
+//the key pressed since the last measurement, set by the keyboard thread and cleared by the main loop
+static volatile int latency_key = -1;
+
+//machines of their own for the timeline with the press and the one without, so the real machine
+//and its keys are never touched
+static struct chip8 *latency_machines[2];
+static struct chip8_snapshot *latency_snapshot;
+
+//totals over the presses that reached the screen within LATENCY_MAX_FRAMES, both ways
+static uint64_t latency_plain_frames;
+static uint64_t latency_shown_frames;
+static uint64_t latency_count;
+
+//presses the game never showed within LATENCY_MAX_FRAMES, in one timeline or both
+static uint64_t latency_missed;
+
 static uint64_t
 time_ms() {
     struct timespec ts;
@@ -129,6 +159,15 @@ time_ms() {
     return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 
+static uint64_t
+time_us() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+
+    return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
 static void
 log_write(const char *fmt, ...) {
     va_list ap;
@@ -146,94 +185,54 @@ log_write(const char *fmt, ...) {
     draw_log = true;
 }
 
-static void
-initialize() {
-    memset(memory, 0, sizeof(memory));
-    memset(V, 0, sizeof(V));
-    memset(stack, 0, sizeof(stack));
-    memset(gfx, 0, sizeof(gfx));
-    memset(key, 0, sizeof(key));
-
-    //program counter starts 512 bytes into memory
-    pc = 0x200;
-
-    opcode = 0;
-    I = 0;
-    sp = 0;
-    dt = 0;
-    st = 0;
-    draw_game = false;
-    draw_log = false;
-
-    //load the font set into memory
-    memcpy(memory, font_set, sizeof(font_set));
-
-    win_game = newwin(GFX_HEIGHT + 2, GFX_WIDTH + 2, 0, 0);
-    win_log = newwin(LOG_LINES_MAX + 2, LOG_LINE_LEN + 2, GFX_HEIGHT + 2, 0);
-    win_debugger = newwin(DEBUGGER_LINES_MAX + 2, DEBUGGER_LINE_LEN + 2, 0, GFX_WIDTH + 2);
-
-    //refresh the stdscr now, since we'll be reading input from it and getch() will cause a refresh() if we don't do it here
-    wrefresh(stdscr);
-
-    box(win_game, ACS_VLINE, ACS_HLINE);
-    box(win_log, ACS_VLINE, ACS_HLINE);
-    box(win_debugger, ACS_VLINE, ACS_HLINE);
-
-    wrefresh(win_game);
-    wrefresh(win_log);
-    wrefresh(win_debugger);
-
-    nodelay(stdscr, TRUE);
-    keypad(stdscr, TRUE);
-
-    nodelay(win_game, TRUE);
-    keypad(win_game, TRUE);
-
-    keypad(win_debugger, TRUE);
-
-    memset(log_lines, 0, sizeof(log_lines));
-
-    pthread_rwlock_init(&dt_lock, NULL);
-    pthread_rwlock_init(&st_lock, NULL);
-}
-
-static bool
-load() {
-    FILE *f;
-    size_t count;
-
-    log_write("Loading %s", opt_path);
-
-    f = fopen(opt_path, "rb");
-    if (f == NULL) {
-        log_write("%s", strerror(errno));
-        return false;
-    }
-
-    //read the ROM starting at 512 bytes into memory
-    count = fread(memory + 512, sizeof(unsigned char), sizeof(memory) - 512, f);
-    fclose(f);
-
-    if (count < sizeof(opcode)) {
-        log_write("Invalid ROM");
-        return false;
-    }
-
-    return true;
-}
+//hi-res is drawn as 2x2 pixels per cell so the window and the amount written to the terminal stay the same
+//indexed by the top left, top right, bottom left and bottom right pixels from the high bit
+static const char quadrants[16] = {
+    ' ', '.', ',', '_', '\'', ']', '/', 'J', '`', '\\', '[', 'L', '"', '7', 'F', ' '
+};
 
 static void
 draw_game_win() {
+    bool hires = chip8->gfx_width == CHIP8_GFX_MAX_WIDTH;
+    uint64_t rows = hires ? 0x3 : 0x1;
+    unsigned int pixel, color, quad, i;
     int x, y;
 
     for (y = 0; y < GFX_HEIGHT; y++) {
+        //only redraw the cells covering rows that changed
+        if (((chip8->gfx_dirty >> (hires ? y * 2 : y)) & rows) == 0) {
+            continue;
+        }
+
         for (x = 0; x < GFX_WIDTH; x++) {
             wmove(win_game, y + 1, x + 1);
 
-            if (gfx[x + (y * 64)]) {
-                wattron(win_game, A_REVERSE | COLOR_PAIR(1));
+            if (hires) {
+                quad = 0;
+                color = 0;
+                for (i = 0; i < 4; i++) {
+                    pixel = chip8_pixel(chip8, x * 2 + (i & 1), y * 2 + (i >> 1));
+                    if (pixel != 0) {
+                        quad |= 0x8 >> i;
+                        color |= pixel;
+                    }
+                }
+            }
+            else {
+                color = chip8_pixel(chip8, x, y);
+                quad = color != 0 ? 0xF : 0;
+            }
+
+            //the color pair is picked by which planes are lit
+            if (quad == 0xF) {
+                wattron(win_game, A_REVERSE | COLOR_PAIR(color));
                 waddch(win_game, ' ');
-                wattroff(win_game, A_REVERSE | COLOR_PAIR(1));
+                wattroff(win_game, A_REVERSE | COLOR_PAIR(color));
+            }
+            else if (quad != 0) {
+                wattron(win_game, COLOR_PAIR(color + 3));
+                waddch(win_game, quadrants[quad]);
+                wattroff(win_game, COLOR_PAIR(color + 3));
             }
             else {
                 waddch(win_game, ' ');
@@ -241,6 +240,7 @@ draw_game_win() {
         }
     }
 
+    chip8->gfx_dirty = 0;
     wrefresh(win_game);
 }
 
@@ -285,14 +285,14 @@ draw_debugger_win(const char *state) {
     mvwprintw(win_debugger, 1, 1, "State: %s", state);
 
     mvwprintw(win_debugger, 3, 1, "Memory");
-    mvwprintw(win_debugger, 4, 1, "PC: %u           I: %u", pc, I);
-    mvwprintw(win_debugger, 5, 1, "Opcode: %04X", opcode);
+    mvwprintw(win_debugger, 4, 1, "PC: %u           I: %u", chip8->pc, chip8->I);
+    mvwprintw(win_debugger, 5, 1, "Opcode: %04X", chip8->opcode);
     for (col = 1; col < DEBUGGER_LINE_LEN - 1; col++) {
         mvwaddch(win_debugger, 6, col, ' ');
     }
 
     //TODO: add the rest of the opcodes
-    switch (opcode & 0xF000) {
+    switch (chip8->opcode & 0xF000) {
         case 0x2000:
             mvwprintw(win_debugger, 6, 1, "Call subroutine at NNN");
             break;
@@ -300,7 +300,7 @@ draw_debugger_win(const char *state) {
             mvwprintw(win_debugger, 6, 1, "Skip next if VX == NN");
             break;
         case 0xF000:
-            switch (opcode & 0x00FF) {
+            switch (chip8->opcode & 0x00FF) {
                 case 0x0055:
                     mvwprintw(win_debugger, 6, 1, "Copy {V0,VX} to {memory[I],memory[I + X]}");
                     break;
@@ -315,48 +315,46 @@ draw_debugger_win(const char *state) {
 
     row = 8;
     mvwprintw(win_debugger, row, 1, "Registers");
-    mvwprintw(win_debugger, row + 1, 1, "V0: 0x%02X", V[0]);
-    mvwprintw(win_debugger, row + 1, 15, "V1: 0x%02X", V[1]);
-    mvwprintw(win_debugger, row + 1, 30, "V2: 0x%02X", V[2]);
-    mvwprintw(win_debugger, row + 2, 1, "V3: 0x%02X", V[3]);
-    mvwprintw(win_debugger, row + 2, 15, "V4: 0x%02X", V[4]);
-    mvwprintw(win_debugger, row + 2, 30, "V5: 0x%02X", V[5]);
-    mvwprintw(win_debugger, row + 3, 1, "V6: 0x%02X", V[6]);
-    mvwprintw(win_debugger, row + 3, 15, "V7: 0x%02X", V[7]);
-    mvwprintw(win_debugger, row + 3, 30, "V8: 0x%02X", V[8]);
-    mvwprintw(win_debugger, row + 4, 1, "V9: 0x%02X", V[9]);
-    mvwprintw(win_debugger, row + 4, 15, "VA: 0x%02X", V[10]);
-    mvwprintw(win_debugger, row + 4, 30, "VB: 0x%02X", V[11]);
-    mvwprintw(win_debugger, row + 5, 1, "VC: 0x%02X", V[12]);
-    mvwprintw(win_debugger, row + 5, 15, "VD: 0x%02X", V[13]);
-    mvwprintw(win_debugger, row + 5, 30, "VE: 0x%02X", V[14]);
-    mvwprintw(win_debugger, row + 6, 1, "VF: 0x%02X", V[15]);
+    mvwprintw(win_debugger, row + 1, 1, "V0: 0x%02X", chip8->V[0]);
+    mvwprintw(win_debugger, row + 1, 15, "V1: 0x%02X", chip8->V[1]);
+    mvwprintw(win_debugger, row + 1, 30, "V2: 0x%02X", chip8->V[2]);
+    mvwprintw(win_debugger, row + 2, 1, "V3: 0x%02X", chip8->V[3]);
+    mvwprintw(win_debugger, row + 2, 15, "V4: 0x%02X", chip8->V[4]);
+    mvwprintw(win_debugger, row + 2, 30, "V5: 0x%02X", chip8->V[5]);
+    mvwprintw(win_debugger, row + 3, 1, "V6: 0x%02X", chip8->V[6]);
+    mvwprintw(win_debugger, row + 3, 15, "V7: 0x%02X", chip8->V[7]);
+    mvwprintw(win_debugger, row + 3, 30, "V8: 0x%02X", chip8->V[8]);
+    mvwprintw(win_debugger, row + 4, 1, "V9: 0x%02X", chip8->V[9]);
+    mvwprintw(win_debugger, row + 4, 15, "VA: 0x%02X", chip8->V[10]);
+    mvwprintw(win_debugger, row + 4, 30, "VB: 0x%02X", chip8->V[11]);
+    mvwprintw(win_debugger, row + 5, 1, "VC: 0x%02X", chip8->V[12]);
+    mvwprintw(win_debugger, row + 5, 15, "VD: 0x%02X", chip8->V[13]);
+    mvwprintw(win_debugger, row + 5, 30, "VE: 0x%02X", chip8->V[14]);
+    mvwprintw(win_debugger, row + 6, 1, "VF: 0x%02X", chip8->V[15]);
 
     row += 8;
     mvwprintw(win_debugger, row, 1, "Stack");
-    mvwprintw(win_debugger, row + 1, 1, "SP: %u", sp);
-    mvwprintw(win_debugger, row + 2, 1, "S0: 0x%04X", stack[0]);
-    mvwprintw(win_debugger, row + 2, 15, "S1: 0x%04X", stack[1]);
-    mvwprintw(win_debugger, row + 2, 30, "S2: 0x%04X", stack[2]);
-    mvwprintw(win_debugger, row + 3, 1, "S3: 0x%04X", stack[3]);
-    mvwprintw(win_debugger, row + 3, 15, "S4: 0x%04X", stack[4]);
-    mvwprintw(win_debugger, row + 3, 30, "S5: 0x%04X", stack[5]);
-    mvwprintw(win_debugger, row + 4, 1, "S6: 0x%04X", stack[6]);
-    mvwprintw(win_debugger, row + 4, 15, "S7: 0x%04X", stack[7]);
-    mvwprintw(win_debugger, row + 4, 30, "S8: 0x%04X", stack[8]);
-    mvwprintw(win_debugger, row + 5, 1, "S9: 0x%04X", stack[9]);
-    mvwprintw(win_debugger, row + 5, 15, "SA: 0x%04X", stack[10]);
-    mvwprintw(win_debugger, row + 5, 30, "SB: 0x%04X", stack[11]);
-    mvwprintw(win_debugger, row + 6, 1, "SC: 0x%04X", stack[12]);
-    mvwprintw(win_debugger, row + 6, 15, "SD: 0x%04X", stack[13]);
-    mvwprintw(win_debugger, row + 6, 30, "SE: 0x%04X", stack[14]);
-    mvwprintw(win_debugger, row + 7, 1, "SF: 0x%04X", stack[15]);
+    mvwprintw(win_debugger, row + 1, 1, "SP: %u", chip8->sp);
+    mvwprintw(win_debugger, row + 2, 1, "S0: 0x%04X", chip8->stack[0]);
+    mvwprintw(win_debugger, row + 2, 15, "S1: 0x%04X", chip8->stack[1]);
+    mvwprintw(win_debugger, row + 2, 30, "S2: 0x%04X", chip8->stack[2]);
+    mvwprintw(win_debugger, row + 3, 1, "S3: 0x%04X", chip8->stack[3]);
+    mvwprintw(win_debugger, row + 3, 15, "S4: 0x%04X", chip8->stack[4]);
+    mvwprintw(win_debugger, row + 3, 30, "S5: 0x%04X", chip8->stack[5]);
+    mvwprintw(win_debugger, row + 4, 1, "S6: 0x%04X", chip8->stack[6]);
+    mvwprintw(win_debugger, row + 4, 15, "S7: 0x%04X", chip8->stack[7]);
+    mvwprintw(win_debugger, row + 4, 30, "S8: 0x%04X", chip8->stack[8]);
+    mvwprintw(win_debugger, row + 5, 1, "S9: 0x%04X", chip8->stack[9]);
+    mvwprintw(win_debugger, row + 5, 15, "SA: 0x%04X", chip8->stack[10]);
+    mvwprintw(win_debugger, row + 5, 30, "SB: 0x%04X", chip8->stack[11]);
+    mvwprintw(win_debugger, row + 6, 1, "SC: 0x%04X", chip8->stack[12]);
+    mvwprintw(win_debugger, row + 6, 15, "SD: 0x%04X", chip8->stack[13]);
+    mvwprintw(win_debugger, row + 6, 30, "SE: 0x%04X", chip8->stack[14]);
+    mvwprintw(win_debugger, row + 7, 1, "SF: 0x%04X", chip8->stack[15]);
 
     row += 9;
-    pthread_rwlock_rdlock(&dt_lock);
-    mvwprintw(win_debugger, row, 1, "DT: %u", dt);
-    pthread_rwlock_unlock(&dt_lock);
-    mvwprintw(win_debugger, row + 1, 1, "ST: %u", st);
+    mvwprintw(win_debugger, row, 1, "DT: %u", chip8->dt);
+    mvwprintw(win_debugger, row + 1, 1, "ST: %u", chip8->st);
 
     row += 3;
     t = time(NULL) - program_start;
@@ -364,11 +362,22 @@ draw_debugger_win(const char *state) {
     if (t > 0) {
         mvwprintw(win_debugger, row + 1, 1, "Actual FPS: %ld", counter_frames / t);
     }
+    mvwprintw(win_debugger, row + 2, 1, "Dropped frames: %llu  time: %llu ms", (unsigned long long)governor.dropped_frames,
+              (unsigned long long)governor.dropped_ms);
+    mvwprintw(win_debugger, row + 3, 1, "Lag: %llu ms  max: %llu ms   ", (unsigned long long)governor.lag_ms,
+              (unsigned long long)governor.lag_max_ms);
+    if (latency_count + latency_missed > 0) {
+        mvwprintw(win_debugger, row + 4, 1, "Input lag: %.1f frames, %.1f with -a %d   ",
+                  latency_count > 0 ? (double)latency_plain_frames / latency_count : 0.0,
+                  latency_count > 0 ? (double)latency_shown_frames / latency_count : 0.0, opt_run_ahead);
+        mvwprintw(win_debugger, row + 5, 1, "over %llu presses, %llu never shown", (unsigned long long)latency_count,
+                  (unsigned long long)latency_missed);
+    }
 
     wrefresh(win_debugger);
 
     if (debugger_stepping) {
-        mvwprintw(win_debugger, row + 3, 1, "Press enter to step."); 
+        mvwprintw(win_debugger, row + 6, 1, "Press enter to step."); 
         while (true) {
             c = wgetch(win_debugger);
 
@@ -379,381 +388,112 @@ draw_debugger_win(const char *state) {
     }
 }
 
-static bool
-cycle() {
-    uint16_t x, xx, y, yy, height, pixel;
-    bool press;
-    int i;
-
-    opcode = memory[pc] << 8 | memory[pc + 1];
-
-    //temporary: was using this to debug a certain opcode
-    if ((opcode & 0xF000) == 0xF000 && (opcode & 0x00FF) == 0x0055) {
-        //debugger_stepping = true;
-    }
-
-    draw_debugger_win("Before Handler");
-
-    switch (opcode & 0xF000) {
-        case 0x0000:
-            switch (opcode & 0x00FF) {
-                case 0x00E0:
-                    //00E0: Clear the screen
-                    memset(gfx, 0, sizeof(gfx));
-                    draw_game = true;
-                    pc += sizeof(opcode);
-                    break;
-                case 0x00EE:
-                    //00EE: Return from a subroutine
-                    pc = stack[--sp] + sizeof(opcode);
-                    break;
-                default:
-                    if (opcode == 0x0000) {
-                        //0NNN: Ignore this since it's ignored by most interpreters now
-                        break;
-                    }
-
-                    log_write("Unhandled 0x0000 opcode 0x%04X", opcode);
-                    return false;
-            }
-
-            break;
-        case 0x1000:
-            //1NNN: Jump to address NNN
-            pc = opcode & 0x0FFF;
-            break;
-        case 0x2000:
-            //2NNN: Execute subroutine starting at address NNN
-            stack[sp++] = pc;
-            pc = opcode & 0x0FFF;
-            break;
-        case 0x3000:
-            //3XNN: Skip the following instruction if the value of register VX equals NN
-            pc += sizeof(opcode);
-            if (V[(opcode & 0x0F00) >> 8] == (opcode & 0x00FF)) {
-                pc += sizeof(opcode);
-            }
-            break;
-        case 0x4000:
-            //4XNN: Skip the following instruction if the value of register VX is not equal to NN
-            pc += sizeof(opcode);
-            if (V[(opcode & 0x0F00) >> 8] != (opcode & 0x00FF)) {
-                pc += sizeof(opcode);
-            }
-            break;
-        case 0x5000:
-            //Skip the following instruction if the value of register VX is equal to the value of register VY
-            pc += sizeof(opcode);
-            if (V[(opcode & 0x0F00) >> 8] == V[(opcode & 0x00F0) >> 4]) {
-                pc += sizeof(opcode);
-            }
-            break;
-        case 0x6000:
-            //6XNN: Sets V[X] to NN
-            V[(opcode & 0x0F00) >> 8] = opcode & 0x00FF;
-            pc += sizeof(opcode);
-            break;
-        case 0x7000:
-            //7XNN: Adds NN to V[X]
-            V[(opcode & 0x0F00) >> 8] += opcode & 0x00FF;
-            pc += sizeof(opcode);
-            break;
-        case 0x8000:
-            x = (opcode & 0x0F00) >> 8;
-            y = (opcode & 0x00F0) >> 4;
-
-            switch (opcode & 0x000F) {
-                case 0x0000:
-                    //8XY0 - Sets VX to the value of VY.
-                    V[x] = V[y];
-                    pc += sizeof(opcode);
-                    break;
-                case 0x0001:
-                    //8XY1 - Sets VX to (VX OR VY).
-                    V[x] |= V[y];
-                    pc += sizeof(opcode);
-                    break;
-                case 0x0002:
-                    //8XY2 - Sets VX to (VX AND VY).
-                    V[x] &= V[y];
-                    pc += sizeof(opcode);
-                    break;
-                case 0x0003:
-                    // 8XY3 - Sets VX to (VX XOR VY).
-                    V[x] ^= V[y];
-                    pc += sizeof(opcode);
-                    break;
-                case 0x0004:
-                    //8XY4 - Adds VY to VX. VF is set to 1 when there's a carry, and to 0 when there isn't.
-                    V[x] += V[y];
-                    if(V[y] > (0xFF - V[x])) {
-                        V[0xF] = 1;
-                    }
-                    else {
-                        V[0xF] = 0;
-                    }
-
-                    pc += sizeof(opcode);
-                    break;
-                case 0x0005:
-                    // 8XY5 - VY is subtracted from VX. VF is set to 0 when there's a borrow, and 1 when there isn't.
-                    if(V[y] > V[x]) {
-                        V[0xF] = 0;
-                    }
-                    else {
-                        V[0xF] = 1;
-                    }
-                    V[x] -= V[y];
-                    pc += sizeof(opcode);
-                    break;
-                case 0x0006:
-                    // 0x8XY6 - Shifts VX right by one. VF is set to the value of the least significant bit of VX before the shift.
-                    V[0xF] = V[x] & 0x1;
-                    V[x] >>= 1;
-                    pc += sizeof(opcode);
-                    break;
-                case 0x0007:
-                    // 0x8XY7: Sets VX to VY minus VX. VF is set to 0 when there's a borrow, and 1 when there isn't.
-                    if(V[x] > V[y]) {
-                        V[0xF] = 0;
-                    }
-                    else {
-                        V[0xF] = 1;
-                    }
+static void
+chip8_on_log(void *ctx, const char *msg) {
+    log_write("%s", msg);
+}
 
-                    V[x] = V[y] - V[x];
-                    pc += sizeof(opcode);
-                    break;
-                case 0x000E:
-                    // 0x8XYE: Shifts VX left by one. VF is set to the value of
-                    // the most significant bit of VX before the shift.
-                    V[0xF] = V[x] >> 7;
-                    V[(opcode & 0x0F00) >> 8] <<= 1;
-                    pc += sizeof(opcode);
-                    break;
-                default:
-                    log_write("Unhandled 0x8000 opcode 0x04%X", opcode);
-                    return false;
-            }
-            break;
-        case 0x9000:
-            //9XY0: Skip the following instruction if the value of register VX is not equal to the value of register VY
-            pc += sizeof(opcode);
-            if (V[(opcode & 0x0F00) >> 8] != V[(opcode & 0x00F0) >> 4]) {
-                pc += sizeof(opcode);
-            }
-            break;
-        case 0xA000:
-            //ANNN: Sets I to the address NNN
-            I = opcode & 0x0FFF;
-            pc += sizeof(opcode);
-            break;
-        case 0xB000:
-            //BNNN: Jumps to NNN + V0
-            pc = (opcode & 0x0FFF) + V[0];
-            break;
-        case 0xC000:
-            //CXNN: Sets VX to a random number masked by NN.
-            V[(opcode & 0x0F00) >> 8] = (rand() % (0xFF + 1)) & (opcode & 0x0FF);
-            pc += sizeof(opcode);
-            break;
-        case 0xD000:
-            //DYXN: Draws a sprite at coordinate (V[X],V[Y]) that has a width of 8 pixels and a height of N pixels
-            x = V[(opcode & 0x0F00) >> 8];
-            y = V[(opcode & 0x00F0) >> 4];
-            height = opcode & 0x000F;
-
-            V[0xF] = 0;
-            for (yy = 0; yy < height; yy++) {
-                pixel = memory[I + yy];
-                for (xx = 0; xx < 8; xx++) {
-                    if ((pixel & (0x80 >> xx)) != 0) {
-                        if (gfx[x + xx + ((y + yy) * 64)] == 1) {
-                            V[0xF] = 1;
-                        }
-
-                        gfx[x + xx + ((y + yy) * 64)] ^= 1;
-                    }
-                }
-            }
+static void
+chip8_on_trace(void *ctx, const struct chip8 *chip8, const char *state) {
+    draw_debugger_win(state);
+}
 
-            draw_game = true;
-            pc += sizeof(opcode);
+static bool
+initialize() {
+    struct chip8_callbacks callbacks = {
+        .log = chip8_on_log,
+        .trace = chip8_on_trace,
+    };
 
-            break;
-        case 0xE000:
-            //EX..
-            x = (opcode & 0x0F00) >> 8;
-
-            switch (opcode & 0x00FF) {
-                case 0x009E:
-                    //EX9E: Skips the next instruction if the key stored in VX is pressed
-                    pc += sizeof(opcode);
-                    if (key[V[x]] != 0) {
-                        pc += sizeof(opcode);
-                    }
-                    break;
-                case 0x00A1:
-                    //EXA1: Skips the next instruction if the key stored in VX is not pressed
-                    pc += sizeof(opcode);
-                    if (key[V[x]] == 0) {
-                        pc += sizeof(opcode);
-                    }
-                    break;
-                default:
-                    log_write("Unhandled 0xE000 opcode 0x%04X", opcode);
-                    return false;
-            }
+    chip8 = chip8_create();
+    if (chip8 == NULL) {
+        return false;
+    }
 
-            break;
-        case 0xF000:
-            //FX..
-            x = (opcode & 0x0F00) >> 8;
+    chip8_set_callbacks(chip8, &callbacks);
+    chip8_set_profile(chip8, opt_profile);
+    chip8_set_dispatch(chip8, opt_dispatch);
+    chip8_seed(chip8, time(NULL));
 
-            switch (opcode & 0x00FF) {
-                case 0x0007:
-                    //FX07: Sets V[X] to the value of the delay timer
-                    pthread_rwlock_rdlock(&dt_lock);
-                    V[x] = dt;
-                    pthread_rwlock_unlock(&dt_lock);
+    draw_game = false;
+    draw_log = false;
 
-                    pc += sizeof(opcode);
-                    break;
-                case 0x000A:
-                    //FX0A: Key press awaited, stored in V[X]
-                    press = false;
-                    for (i = 0; i < 16 && !press; i++) {
-                        if (key[i] != 0) {
-                            V[x] = i;
-                            press = true;
-                        }
-                    }
+    win_game = newwin(GFX_HEIGHT + 2, GFX_WIDTH + 2, 0, 0);
+    win_log = newwin(LOG_LINES_MAX + 2, LOG_LINE_LEN + 2, GFX_HEIGHT + 2, 0);
+    win_debugger = newwin(DEBUGGER_LINES_MAX + 2, DEBUGGER_LINE_LEN + 2, 0, GFX_WIDTH + 2);
 
-                    if (press) {
-                        pc += sizeof(opcode);
-                    }
+    //refresh the stdscr now, since we'll be reading input from it and getch() will cause a refresh() if we don't do it here
+    wrefresh(stdscr);
 
-                    break;
-                case 0x0015:
-                    //FX15: Sets the delay timer to V[X]
-                    pthread_rwlock_wrlock(&dt_lock);
-                    dt = V[x];
-                    pthread_rwlock_unlock(&dt_lock);
+    box(win_game, ACS_VLINE, ACS_HLINE);
+    box(win_log, ACS_VLINE, ACS_HLINE);
+    box(win_debugger, ACS_VLINE, ACS_HLINE);
 
-                    pc += sizeof(opcode);
-                    break;
-                case 0x0018:
-                    //FX18: Sets the sound timer to V[X]
-                    pthread_rwlock_wrlock(&st_lock);
-                    st = V[x];
-                    pthread_rwlock_unlock(&st_lock);
+    wrefresh(win_game);
+    wrefresh(win_log);
+    wrefresh(win_debugger);
 
-                    pc += sizeof(opcode);
-                    break;
-                case 0x001E:
-                    //FX1E: V[F] is set to 1 when there's an overflow, otherwise 0
-                    if (I + V[x] > 0xFFF) {
-                        V[0xF] = 1;
-                    }
-                    else {
-                        V[0xF] = 0;
-                    }
+    nodelay(stdscr, TRUE);
+    keypad(stdscr, TRUE);
 
-                    I += V[x];
-                    pc += sizeof(opcode);
-                    break;
-                case 0x0029:
-                    //FX29: Sets I to the location of the sprite for the character in V[X]. Characters 0-F are represented by a 4x5 font
-                    I = V[x] * 0x5;
-                    pc += sizeof(opcode);
-                    break;
-                case 0x0033:
-                    //FX33: Stores the binary encoded decimal representation of V[X] at the addresses I, I+1, I+2
-                    memory[I] = V[x] / 100;
-                    memory[I + 1] = (V[x] / 10) % 10;
-                    memory[I + 2] = V[x] % 10;
-                    pc += sizeof(opcode);
-                    break;
-                case 0x0055:
-                    //FX55: Stores V[0] - V[X] in memory starting at address I
-                    for (i = 0; i <= x; i++) {
-                        memory[I + i] = V[i];
-                    }
+    nodelay(win_game, TRUE);
+    keypad(win_game, TRUE);
 
-                    I += x + 1;
-                    pc += sizeof(opcode);
-                    break;
-                case 0x0065:
-                    //FX65: 
-                    for (i = 0; i <= x; i++) {
-                        V[i] = memory[I + i];
-                    }
+    keypad(win_debugger, TRUE);
 
-                    I += x + 1;
-                    pc += sizeof(opcode);
-                    break;
-                default:
-                    log_write("Unhandled 0xF000 opcode 0x%04X", opcode);
-                    return false;
-            }
+    memset(log_lines, 0, sizeof(log_lines));
 
-            break;
-        default:
-            log_write("Unhandled opcode 0x04%X", opcode);
+    if (opt_run_ahead > 0) {
+        run_ahead_snapshot = malloc(sizeof(*run_ahead_snapshot));
+        if (run_ahead_snapshot == NULL) {
             return false;
+        }
     }
 
-    draw_debugger_win("After Handler");
-    return true;
-}
-
-//these timers always count at 60Hz
-static void *
-handle_timers(void *ptr) {
-    uint64_t frame_start, diff;
-    double ms_per_frame;
-    bool do_beep;
-
-    ms_per_frame = 1000.0 / 60.0;
+    if (opt_latency) {
+        latency_machines[0] = chip8_create();
+        latency_machines[1] = chip8_create();
+        latency_snapshot = malloc(sizeof(*latency_snapshot));
+        if (latency_machines[0] == NULL || latency_machines[1] == NULL || latency_snapshot == NULL) {
+            return false;
+        }
 
-    while (looping) {
-        frame_start = time_ms();
+        chip8_set_dispatch(latency_machines[0], opt_dispatch);
+        chip8_set_dispatch(latency_machines[1], opt_dispatch);
+    }
 
-        pthread_rwlock_wrlock(&dt_lock);
-        if (dt > 0) {
-            --dt;
+    if (opt_wav != NULL || opt_pipe != NULL) {
+        audio = chip8_audio_create(CHIP8_AUDIO_DEFAULT_RATE, CHIP8_AUDIO_DEFAULT_CHUNK_TICKS);
+        if (audio == NULL) {
+            return false;
         }
-        pthread_rwlock_unlock(&dt_lock);
 
-        do_beep = false;
-        pthread_rwlock_wrlock(&st_lock);
-        if (st > 0) {
-            if (st == 1) {
-                do_beep = true;
-            }
-            --st;
-        }
-        pthread_rwlock_unlock(&st_lock);
-        if (do_beep) {
-            beep();
+        if (opt_wav != NULL && !chip8_audio_open_wav(audio, opt_wav)) {
+            log_write("Could not write audio to %s", opt_wav);
+            return false;
         }
 
-        diff = time_ms() - frame_start;
-        if (diff < ms_per_frame) {
-            usleep(1000 * (ms_per_frame - diff));
+        if (opt_pipe != NULL) {
+            //a player that quits shouldn't take the emulator down with it
+            signal(SIGPIPE, SIG_IGN);
+
+            if (!chip8_audio_open_pipe(audio, opt_pipe)) {
+                log_write("Could not run %s", opt_pipe);
+                return false;
+            }
         }
     }
 
-    return NULL;
+    return true;
 }
 
-
 //ncurses doesn't have good keyboard support so our keyboard handling is going to 
 //be a little slow to respond
 //simulate keyup and keydown
 //keyup occurs after 100ms of it not being down
 static void *
 handle_keyboard(void *ptr) {
+    unsigned char *key = chip8_keys(chip8);
     uint64_t timers[16], now;
     int i, c;
 
@@ -763,8 +503,12 @@ handle_keyboard(void *ptr) {
         while ((c = wgetch(stdscr)) != ERR) {
             for (i = 0; i < 16; i++) {
                 if (c == key_map[i]) {
+                    if (opt_latency && key[i] == 0 && latency_key < 0) {
+                        latency_key = i;
+                    }
+
                     key[i] = 1;
-                    timers[i] = time_ms() + 100;
+                    timers[i] = time_ms() + KEY_HOLD_MS;
                     break;
                 }
             }
@@ -800,8 +544,28 @@ usage(const char *fmt, ...) {
     puts("Options:");
     puts(" -f <fps>    Set the frames per second of the CPU. Certain games run better with");
     puts("             higher values. The default is 120.");
+    puts(" -l <ms>     How far the emulation may fall behind a busy host and still catch up.");
+    puts("             Beyond that the time is skipped. The default is 250.");
+    puts(" -r <count>  Renders that may be skipped in a row while catching up. The default is 4.");
+    puts(" -a <frames> Shows the game this many 60Hz frames ahead with the keys held as they are,");
+    puts("             hiding that much of the game's own input lag. The default is 0.");
+    puts(" -m          Measures how many frames every key press takes to show, with and without");
+    puts("             run-ahead, in the debugger. Each press runs the game ahead twice, so it's off");
+    puts("             by default.");
     puts(" -c <color>  Sets the color of the pixels. The default is green.");
     puts("             Valid colors: red, green, blue, yellow, magenta, cyan, white.");
+    puts(" -q <quirks> Sets the quirk profile for games written for other interpreters.");
+    puts("             The default is default.");
+    puts("             Valid profiles: default, cosmac, schip, xochip, custom.");
+    puts(" -d <method> Sets how opcodes are decoded. Run chip8bench to find the fastest");
+    puts("             for this machine. The default is switch.");
+    puts("             Valid methods: switch, table, threaded.");
+    puts(" -k <keys>   The 16 keyboard keys for keypad keys 0-F. The default is 1234qwerasdfzxcv.");
+    puts(" -b <path>   ROM database holding the settings for each ROM. The default is ~/" DB_DEFAULT_NAME ".");
+    puts(" -s          Saves -f, -q and -k to the ROM database as this ROM's settings.");
+    puts(" -w <path>   Writes the sound to a WAV file instead of ringing the terminal bell.");
+    puts(" -p <cmd>    Pipes the sound as raw 16 bit 44100Hz mono PCM to a command instead");
+    puts("             of ringing the terminal bell, e.g. \"aplay -q -f S16_LE -r 44100\".");
 }
 
 static bool
@@ -811,10 +575,33 @@ parse_args(int argc, char **argv) {
     for (i = 1; i < argc; i++) {
         if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
             opt_fps = atoi(argv[++i]);
-            if (opt_fps < 60) {
+            if (opt_fps < FPS_MIN) {
                 usage("FPS cannot be lower than 60");
                 return false;
             }
+
+            opt_fps_set = true;
+        }
+        else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+            opt_max_lag = atoi(argv[++i]);
+            if (opt_max_lag < 0) {
+                usage("Invalid lag limit");
+                return false;
+            }
+        }
+        else if (strcmp(argv[i], "-a") == 0 && i + 1 < argc) {
+            opt_run_ahead = atoi(argv[++i]);
+            if (opt_run_ahead < 0) {
+                usage("Invalid run-ahead");
+                return false;
+            }
+        }
+        else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            opt_max_skip = atoi(argv[++i]);
+            if (opt_max_skip < 0) {
+                usage("Invalid render skip limit");
+                return false;
+            }
         }
         else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
             ++i;
@@ -844,6 +631,44 @@ parse_args(int argc, char **argv) {
                 return false;
             }
         }
+        else if (strcmp(argv[i], "-q") == 0 && i + 1 < argc) {
+            if (!chip8_profile_find(argv[++i], &opt_profile)) {
+                usage("Invalid quirk profile");
+                return false;
+            }
+
+            opt_profile_set = true;
+        }
+        else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            if (!chip8_dispatch_find(argv[++i], &opt_dispatch)) {
+                usage("Invalid dispatch method");
+                return false;
+            }
+        }
+        else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc) {
+            opt_keys = argv[++i];
+            if (strlen(opt_keys) != 16) {
+                usage("The key map needs exactly 16 keys");
+                return false;
+            }
+
+            memcpy(key_map, opt_keys, 16);
+        }
+        else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            opt_db = argv[++i];
+        }
+        else if (strcmp(argv[i], "-m") == 0) {
+            opt_latency = true;
+        }
+        else if (strcmp(argv[i], "-s") == 0) {
+            opt_save = true;
+        }
+        else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+            opt_wav = argv[++i];
+        }
+        else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            opt_pipe = argv[++i];
+        }
         else {
             opt_path = argv[i];
             break;
@@ -858,43 +683,350 @@ parse_args(int argc, char **argv) {
     return true;
 }
 
+//looks the loaded ROM up in the ROM database and applies its settings, unless they were given
+//on the command line, a ROM seen for the first time is analyzed and added with the profile it points to
+static void
+configure_from_db() {
+    struct chip8_db *db;
+    const struct chip8_db_entry *found;
+    struct chip8_db_entry entry;
+    char path[1024];
+    const char *home;
+    int i;
+
+    if (opt_db != NULL) {
+        snprintf(path, sizeof(path), "%s", opt_db);
+    }
+    else {
+        home = getenv("HOME");
+        if (home == NULL) {
+            return;
+        }
+
+        snprintf(path, sizeof(path), "%s/%s", home, DB_DEFAULT_NAME);
+    }
+
+    db = chip8_db_open(path);
+    if (db == NULL) {
+        log_write("Could not open the ROM database %s", path);
+        return;
+    }
+
+    found = chip8_db_find(db, chip8_rom_hash(chip8->rom, chip8->rom_size), chip8->rom_size);
+    if (found != NULL) {
+        entry = *found;
+    }
+    else {
+        memset(&entry, 0, sizeof(entry));
+        entry.hash = chip8_rom_hash(chip8->rom, chip8->rom_size);
+        entry.rom_size = chip8->rom_size;
+        chip8_rom_analyze(chip8->rom, chip8->rom_size, &entry.analysis);
+        entry.profile = entry.analysis.profile;
+    }
+
+    if (!opt_profile_set && entry.profile < CHIP8_PROFILE_COUNT) {
+        opt_profile = entry.profile;
+    }
+    //0 means nobody tuned it, anything else -f wouldn't accept is a damaged entry and the default stays
+    if (!opt_fps_set && entry.speed >= FPS_MIN && entry.speed <= INT_MAX) {
+        opt_fps = entry.speed;
+    }
+    else if (!opt_fps_set && entry.speed != 0) {
+        log_write("Ignoring the invalid speed %u in the ROM database", (unsigned int)entry.speed);
+    }
+    if (opt_keys == NULL) {
+        for (i = 0; i < 16; i++) {
+            if (entry.key_map[i] != 0) {
+                key_map[i] = entry.key_map[i];
+            }
+        }
+    }
+
+    //the profile decides the memory size and fonts, so the ROM has to be reloaded under it
+    if (opt_profile != chip8->profile) {
+        chip8_set_profile(chip8, opt_profile);
+        chip8_reset(chip8);
+    }
+
+    if (opt_save) {
+        entry.speed = opt_fps;
+        entry.profile = opt_profile;
+        entry.tuned = 1;
+        memcpy(entry.key_map, key_map, sizeof(entry.key_map));
+    }
+
+    if ((found == NULL || opt_save) && !chip8_db_put(db, &entry)) {
+        log_write("Could not update the ROM database %s", path);
+    }
+
+    log_write("ROM %016llX: %s, %d instr/s%s", (unsigned long long)entry.hash,
+              chip8_profile_name(opt_profile), opt_fps, entry.tuned ? "" : " (guessed)");
+
+    chip8_db_close(db);
+}
+
+//runs count instruction slots, ticking the timers every time emulated time crosses a 60th of a second
+//so they stay in step with the instructions however the batches fall
+static unsigned int
+governor_run(uint64_t count) {
+    uint64_t next_tick, n;
+    unsigned int events = 0, e;
+
+    while (count > 0) {
+        next_tick = ((governor.ticks + 1) * opt_fps + 59) / 60;
+        n = count < next_tick - governor.slots ? count : next_tick - governor.slots;
+
+        e = chip8_run_cycles(chip8, n);
+        events |= e;
+        if (audio != NULL) {
+            chip8_audio_update(audio, chip8);
+        }
+
+        governor.slots += n;
+        counter_frames += n;
+        count -= n;
+
+        if (e & (CHIP8_EVENT_UNHANDLED | CHIP8_EVENT_EXIT)) {
+            break;
+        }
+
+        if (governor.slots == next_tick) {
+            events |= chip8_tick_timers(chip8);
+            if (audio != NULL) {
+                chip8_audio_tick(audio, chip8);
+            }
+
+            ++governor.ticks;
+        }
+    }
+
+    return events;
+}
+
+//moves machine opt_run_ahead ticks on with its keys as they are, the future render() shows,
+//after saving the present in save for chip8_restore() to put back
+static void
+run_ahead(struct chip8 *machine, struct chip8_snapshot *save) {
+    int i;
+
+    chip8_snapshot(machine, save);
+
+    for (i = 0; i < opt_run_ahead; i++) {
+        if (chip8_run_cycles(machine, (opt_fps + 59) / 60) & (CHIP8_EVENT_UNHANDLED | CHIP8_EVENT_EXIT)) {
+            break;
+        }
+
+        chip8_tick_timers(machine);
+    }
+}
+
+static uint64_t
+screen_hash(const struct chip8 *machine) {
+    return chip8_rom_hash((const unsigned char *)chip8_gfx(machine), sizeof(machine->gfx));
+}
+
+//follows the press of latency_key in both timelines until render() would show it, with and without run-ahead
+static void
+measure_latency() {
+    int key = latency_key, hold = (KEY_HOLD_MS * 60 + 999) / 1000, tick, m, plain = 0, shown = 0;
+    uint64_t screens[2][2];
+    bool running[2] = {true, true};
+    struct chip8 *machine;
+
+    latency_key = -1;
+
+    //the press lands between two batches of the main loop, so both timelines start from the machine as it is now
+    chip8_snapshot(chip8, latency_snapshot);
+    for (m = 0; m < 2; m++) {
+        chip8_set_profile(latency_machines[m], chip8->profile);
+        chip8_restore(latency_machines[m], latency_snapshot);
+        memcpy(chip8_keys(latency_machines[m]), chip8_keys(chip8), 16);
+        chip8_keys(latency_machines[m])[key] = m == 0;
+    }
+
+    for (tick = 1; tick <= LATENCY_MAX_FRAMES && (plain == 0 || shown == 0); tick++) {
+        for (m = 0; m < 2; m++) {
+            machine = latency_machines[m];
+            if (tick > hold) {
+                chip8_keys(machine)[key] = 0;
+            }
+
+            if (running[m]) {
+                running[m] = (chip8_run_cycles(machine, (opt_fps + 59) / 60) & (CHIP8_EVENT_UNHANDLED | CHIP8_EVENT_EXIT)) == 0;
+                chip8_tick_timers(machine);
+            }
+
+            screens[m][0] = screen_hash(machine);
+            run_ahead(machine, latency_snapshot);
+            screens[m][1] = screen_hash(machine);
+            chip8_restore(machine, latency_snapshot);
+        }
+
+        if (plain == 0 && screens[0][0] != screens[1][0]) {
+            plain = tick;
+        }
+        if (shown == 0 && screens[0][1] != screens[1][1]) {
+            shown = tick;
+        }
+    }
+
+    //a press the game ignored has no latency to speak of
+    if (plain == 0 || shown == 0) {
+        ++latency_missed;
+        return;
+    }
+
+    latency_plain_frames += plain;
+    latency_shown_frames += shown;
+    ++latency_count;
+}
+
+//draws the frame the player should see: the machine as it is or, with run-ahead, as it will be
+//opt_run_ahead ticks from now if the keys stay as they are, after which the machine is put back
+static void
+render() {
+    struct chip8_callbacks callbacks, none;
+
+    if (opt_run_ahead > 0) {
+        //that future is thrown away, so it mustn't reach the debugger or the log
+        callbacks = chip8->callbacks;
+        memset(&none, 0, sizeof(none));
+        chip8_set_callbacks(chip8, &none);
+
+        run_ahead(chip8, run_ahead_snapshot);
+
+        chip8_set_callbacks(chip8, &callbacks);
+
+        //the screen shows another timeline than the one the dirty rows were tracked on
+        chip8->gfx_dirty = ~0ULL;
+    }
+
+    draw_game_win();
+
+    if (opt_run_ahead > 0) {
+        chip8_restore(chip8, run_ahead_snapshot);
+    }
+}
+
 int
 main(int argc, char **argv) {
-    uint64_t frame_start, diff;
-    bool success = true;
-    double ms_per_frame;
+    uint64_t now, wake, due, behind, limit, slots_per_tick, ticks;
+    struct chip8_callbacks callbacks;
+    unsigned int events;
+    bool success = true, loaded = false;
 
     if (!parse_args(argc, argv)) {
         return 1;
     }
 
-    srand(time(NULL));
-
     initscr();
     noecho();
     curs_set(0);
 
     start_color();
+    //pairs 1-3 fill a cell for each combination of lit XO-CHIP planes, 4-6 draw the hi-res quadrant characters
     init_pair(1, opt_color, opt_color);
+    init_pair(2, COLOR_WHITE, COLOR_WHITE);
+    init_pair(3, COLOR_YELLOW, COLOR_YELLOW);
+    init_pair(4, opt_color, COLOR_BLACK);
+    init_pair(5, COLOR_WHITE, COLOR_BLACK);
+    init_pair(6, COLOR_YELLOW, COLOR_BLACK);
 
-    initialize();
-    success = load();
+    success = initialize();
+    if (success) {
+        success = chip8_load(chip8, opt_path);
+    }
+
+    if (success) {
+        configure_from_db();
+    }
 
     if (success) {
-        pthread_create(&thread_timers, NULL, handle_timers, NULL);
         pthread_create(&thread_keys, NULL, handle_keyboard, NULL);
+        loaded = true;
     }
 
-    ms_per_frame = 1000.0 / (double)opt_fps;
     program_start = time(NULL);
 
+    //a batch is at most a 60th of a second, the delay timer and sound timer always count at 60Hz
+    slots_per_tick = (opt_fps + 59) / 60;
+    limit = (uint64_t)opt_max_lag * opt_fps / 1000;
+
+    memset(&governor, 0, sizeof(governor));
+    governor.start_us = time_us();
+
     while (success && looping) {
-        frame_start = time_ms();
-        success = cycle();
+        now = time_us();
+        due = (now - governor.start_us) * opt_fps / 1000000;
+
+        if (due <= governor.slots) {
+            //ahead of the wall clock, wait for the next slot
+            wake = governor.start_us + (governor.slots + 1) * 1000000 / opt_fps;
+            if (wake > now) {
+                usleep(wake - now);
+            }
+            continue;
+        }
+
+        behind = due - governor.slots;
+
+        //too far behind to catch up without the game visibly speeding up, give the rest of the time up
+        if (behind > limit + 1) {
+            governor.start_us += (behind - limit - 1) * 1000000 / opt_fps;
+            governor.dropped_ms += (behind - limit - 1) * 1000 / opt_fps;
+            behind = limit + 1;
+        }
 
-        if (draw_game) {
-            draw_game_win();
+        governor.lag_ms = (behind - 1) * 1000 / opt_fps;
+        if (governor.lag_ms > governor.lag_max_ms) {
+            governor.lag_max_ms = governor.lag_ms;
+        }
+
+        if (opt_latency && latency_key >= 0) {
+            measure_latency();
+        }
+
+        ticks = governor.ticks;
+        if (behind > slots_per_tick && !debugger_stepping) {
+            //redrawing the debugger twice an instruction would eat the time meant for catching up,
+            //so the batch runs untraced and the debugger shows where it ended
+            callbacks = chip8->callbacks;
+            callbacks.trace = NULL;
+            chip8_set_callbacks(chip8, &callbacks);
+
+            events = governor_run(slots_per_tick);
+
+            callbacks.trace = chip8_on_trace;
+            chip8_set_callbacks(chip8, &callbacks);
+            draw_debugger_win("After Handler");
+        }
+        else {
+            events = governor_run(behind < slots_per_tick ? behind : slots_per_tick);
+        }
+        success = (events & CHIP8_EVENT_UNHANDLED) == 0;
+        if (events & CHIP8_EVENT_EXIT) {
+            looping = false;
+        }
+
+        if ((events & CHIP8_EVENT_SOUND_OFF) && audio == NULL) {
+            beep();
+        }
+
+        //run-ahead shows a future that moves on every tick, whether or not the present drew anything
+        if ((events & CHIP8_EVENT_FRAME) || (opt_run_ahead > 0 && governor.ticks != ticks)) {
+            draw_game = true;
+        }
+
+        //while more than a batch is still owed, only every few renders are drawn so the time goes
+        //to the instructions, the framebuffer stays dirty and is drawn whole once caught up
+        if (draw_game && behind > slots_per_tick && governor.skipped < (unsigned int)opt_max_skip) {
+            ++governor.skipped;
+            ++governor.dropped_frames;
+        }
+        else if (draw_game) {
+            render();
             draw_game = false;
+            governor.skipped = 0;
         }
 
         if (!success) {
@@ -909,13 +1041,6 @@ main(int argc, char **argv) {
         if (!success) {
             break;
         }
-
-        diff = time_ms() - frame_start;
-        if (diff < ms_per_frame) {
-            usleep(1000 * (ms_per_frame - diff));
-        }
-
-        ++counter_frames;
     }
 
     looping = false;
@@ -925,10 +1050,16 @@ main(int argc, char **argv) {
         fgetc(stdin);
     }
 
-    pthread_join(thread_timers, NULL);
-    pthread_join(thread_keys, NULL);
-    pthread_rwlock_destroy(&dt_lock);
-    pthread_rwlock_destroy(&st_lock);
+    if (loaded) {
+        pthread_join(thread_keys, NULL);
+    }
+
+    chip8_audio_destroy(audio);
+    free(run_ahead_snapshot);
+    free(latency_snapshot);
+    chip8_destroy(latency_machines[0]);
+    chip8_destroy(latency_machines[1]);
+    chip8_destroy(chip8);
     delwin(win_game);
     delwin(win_log);
     delwin(win_debugger);